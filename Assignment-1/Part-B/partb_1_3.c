@@ -1,143 +1,191 @@
+// Per-operation messages use pr_debug(), which compiles to nothing unless the
+// module is built with DEBUG or enabled at runtime through dynamic debug
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
 #include <linux/errno.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/poll.h>
 #include <linux/proc_fs.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/wait.h>
+
+// The heap is the min-max heap shared with Assignment-2, only extract_min() is used here
+#include "../../common/pq_heap.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Vanshita Garg and Ashutosh Kumar Singh");
 MODULE_DESCRIPTION("LKM for a priority queue");
 MODULE_VERSION("0.1");
 
+static bool blocking_read = false;
+module_param(blocking_read, bool, 0644);
+MODULE_PARM_DESC(blocking_read, "Reads of files opened from now on wait for an element on an empty queue unless the file has O_NONBLOCK");
+
+static bool read_records = false;
+module_param(read_records, bool, 0644);
+MODULE_PARM_DESC(read_records, "Reads of files opened from now on return struct pb_record {value, priority, insert time} instead of bare values");
+
 #define PROCFS_NAME "partb_1_3"
-#define PROCFS_MAX_SIZE 1024
+#define PB_RECORD_SIZE 8     // one {value, priority} pair of ints in a multi-record write
+#define PB_RECORD_WINDOW 32  // records of a write copied in at a time
 
-struct element {
+// What a read returns per element on a file opened with read_records set
+struct pb_record {
     int val;
     int priority;
     int insert_time;
 };
 
 struct priority_queue {
+    struct mutex lock;  // serializes all operations on this queue and its process node
+    wait_queue_head_t readq;   // readers waiting for an element
+    wait_queue_head_t writeq;  // writers waiting for free space
     struct element *heap;
     int size;
-    int capacity;
+    int alloc;          // number of elements the heap array can hold
+    int notified_size;  // size when waiters were last woken
+    int capacity;       // maximum number of elements, or PQ_UNBOUNDED
     int last_value;
     int timer;
 };
 
-// Comparison first based on priority and then on insert time
-int compare(struct element *a, struct element *b) {
-    if (a->priority < b->priority) {
-        return 1;
-    } else if (a->priority > b->priority) {
-        return 0;
-    } else {
-        return a->insert_time < b->insert_time;
-    }
-}
-
 enum proc_state {
     PROC_FILE_OPEN,
     PROC_READ_VALUE,
     PROC_READ_PRIORITY,
 };
 
-// Linked list of processes
+// Per open file state, stored in file->private_data and protected by proc_pq->lock
 struct process_node {
-    pid_t pid;
+    pid_t pid;  // process that opened the proc file
+    struct file *file;
     enum proc_state state;
-    struct priority_queue *proc_pq;
-    struct process_node *next;
+    bool blocking_read;  // blocking_read at open, O_NONBLOCK still applies per read
+    bool read_records;   // read_records at open, a reader keeps the layout it opened the file with
+    struct priority_queue *proc_pq;  // allocated at open, lives as long as the file
 };
 
 // Global variables
 static struct proc_dir_entry *proc_file;
-static char procfs_buffer[PROCFS_MAX_SIZE];
-static size_t procfs_buffer_size = 0;
-static struct process_node *process_list = NULL;
-
-DEFINE_MUTEX(mutex);
 
 // Priority queue functions
 
-// Initialize the priority queue
-static struct priority_queue *create_pq(int capacity) {
+// Allocate an empty priority queue, its heap is allocated once the capacity is set
+static struct priority_queue *create_pq(void) {
     struct priority_queue *pq = kmalloc(sizeof(struct priority_queue), GFP_KERNEL);
     if (pq == NULL) {
         printk(KERN_ALERT "Error: could not allocate memory for priority queue\n");
         return NULL;
     }
-    pq->heap = kmalloc(capacity * sizeof(struct element), GFP_KERNEL);
-    if (pq->heap == NULL) {
+    mutex_init(&pq->lock);
+    init_waitqueue_head(&pq->readq);
+    init_waitqueue_head(&pq->writeq);
+    pq->heap = NULL;
+    pq->size = 0;
+    pq->alloc = 0;
+    pq->notified_size = 0;
+    pq->capacity = 0;
+    pq->last_value = 0;
+    pq->timer = 0;
+    return pq;
+}
+
+// Maximum number of elements the queue may hold
+static int pq_limit(struct priority_queue *pq) {
+    return pq_capacity_limit(pq->capacity);
+}
+
+static int pq_full(struct priority_queue *pq) {
+    return pq->size >= pq_limit(pq);
+}
+
+// Move the heap to a new array of alloc elements, kvmalloc avoids high-order pages for big heaps
+static int resize_heap(struct priority_queue *pq, int alloc) {
+    struct element *heap = kvmalloc_array(alloc, sizeof(struct element), GFP_KERNEL);
+    if (heap == NULL) {
+        return -ENOMEM;
+    }
+    if (pq->size > 0) {
+        memcpy(heap, pq->heap, pq->size * sizeof(struct element));
+    }
+    kvfree(pq->heap);
+    pq->heap = heap;
+    pq->alloc = alloc;
+    return 0;
+}
+
+// Make room for n elements, growing the heap array geometrically
+static int reserve_pq(struct priority_queue *pq, int n) {
+    if (n <= pq->alloc) {
+        return 0;
+    }
+    if (resize_heap(pq, pq_grow_alloc(pq->alloc, n, pq_limit(pq))) < 0) {
         printk(KERN_ALERT "Error: could not allocate memory for priority queue heap array\n");
-        return NULL;
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+// Halve the heap array once the queue has drained to a quarter of it
+static void shrink_pq(struct priority_queue *pq) {
+    int alloc = pq_shrink_alloc(pq->alloc, pq->size);
+    if (alloc < pq->alloc) {
+        // On failure the queue simply keeps the larger array
+        resize_heap(pq, alloc);
     }
+}
+
+// (Re)initialize the priority queue with the given capacity, dropping all its elements
+static int reset_pq(struct priority_queue *pq, int capacity) {
+    kvfree(pq->heap);
+    pq->heap = NULL;
     pq->size = 0;
-    pq->capacity = capacity;
+    pq->alloc = 0;
     pq->last_value = 0;
     pq->timer = 0;
-    return pq;
+    pq->capacity = capacity;
+    if (reserve_pq(pq, min(pq_limit(pq), PQ_MIN_ALLOC)) < 0) {
+        pq->capacity = 0;
+        return -ENOMEM;
+    }
+    return 0;
 }
 
 // Insert an element into the priority queue
 static int insert_pq(struct priority_queue *pq, int val, int priority) {
-    int i;
-    if (pq->size == pq->capacity) {
-        printk(KERN_ALERT "Error: priority queue is full\n");
+    struct element elem = {val, priority, pq->timer, -1};
+    if (pq_full(pq)) {
+        pr_debug("Error: priority queue is full\n");
         return -EACCES;
     }
-    pq->heap[pq->size].val = val;
-    pq->heap[pq->size].priority = priority;
-    pq->heap[pq->size].insert_time = pq->timer;
-    pq->timer++;
-
-    i = pq->size;
-    while (i > 0 && compare(&pq->heap[i], &pq->heap[(i - 1) / 2])) {
-        struct element temp = pq->heap[i];
-        pq->heap[i] = pq->heap[(i - 1) / 2];
-        pq->heap[(i - 1) / 2] = temp;
-        i = (i - 1) / 2;
+    if (reserve_pq(pq, pq->size + 1) < 0) {
+        return -ENOMEM;
     }
+    pq->timer++;
+    minmax_push(pq->heap, pq->size, NULL, &elem);
     pq->size++;
     return 0;
 }
 
 // Extract the minimum element from the priority queue
 static int extract_min(struct priority_queue *pq) {
-    int min_val, i, left, right, min_child;
+    int min_val;
     if (pq->size == 0) {
-        printk(KERN_ALERT "Error: priority queue is empty\n");
+        pr_debug("Error: priority queue is empty\n");
         return -EACCES;
     }
     min_val = pq->heap[0].val;
-    pq->heap[0] = pq->heap[pq->size - 1];
+    minmax_remove(pq->heap, pq->size, NULL, 0);
     pq->size--;
-    i = 0;
-    while (i < pq->size) {
-        left = 2 * i + 1;
-        right = 2 * i + 2;
-        if (left >= pq->size) {
-            break;
-        }
-        min_child = left;
-        if (right < pq->size && compare(&pq->heap[right], &pq->heap[left])) {
-            min_child = right;
-        }
-        if (!compare(&pq->heap[i], &pq->heap[min_child])) {
-            struct element temp = pq->heap[i];
-            pq->heap[i] = pq->heap[min_child];
-            pq->heap[min_child] = temp;
-            i = min_child;
-        } else {
-            break;
-        }
-    }
+    shrink_pq(pq);
     return min_val;
 }
 
@@ -158,34 +206,28 @@ static void print_pq(struct priority_queue *pq) {
 // Free the memory allocated to the priority queue
 static void delete_pq(struct priority_queue *pq) {
     if (pq != NULL) {
-        kfree(pq->heap);
+        mutex_destroy(&pq->lock);
+        kvfree(pq->heap);
         kfree(pq);
     }
 }
 
-// Find the process node with the given pid
-static struct process_node *find_process(pid_t pid) {
-    struct process_node *curr = process_list;
-    while (curr != NULL) {
-        if (curr->pid == pid) {
-            return curr;
-        }
-        curr = curr->next;
-    }
-    return NULL;
-}
-
-// Insert a process node with the given pid
-static struct process_node *insert_process(pid_t pid) {
+// Allocate the state for a new open of the proc file
+static struct process_node *create_process_node(pid_t pid, struct file *file) {
     struct process_node *node = kmalloc(sizeof(struct process_node), GFP_KERNEL);
     if (node == NULL) {
         return NULL;
     }
     node->pid = pid;
+    node->file = file;
     node->state = PROC_FILE_OPEN;
-    node->proc_pq = NULL;
-    node->next = process_list;
-    process_list = node;
+    node->blocking_read = READ_ONCE(blocking_read);
+    node->read_records = READ_ONCE(read_records);
+    node->proc_pq = create_pq();
+    if (node->proc_pq == NULL) {
+        kfree(node);
+        return NULL;
+    }
     return node;
 }
 
@@ -197,245 +239,282 @@ static void delete_process_node(struct process_node *node) {
     }
 }
 
-// Delete a process node with the given pid
-static int delete_process(pid_t pid) {
-    struct process_node *prev = NULL;
-    struct process_node *curr = process_list;
-    while (curr != NULL) {
-        if (curr->pid == pid) {
-            if (prev == NULL) {
-                process_list = curr->next;
-            } else {
-                prev->next = curr->next;
-            }
-            delete_process_node(curr);
-            return 0;
-        }
-        prev = curr;
-        curr = curr->next;
-    }
-    return -EACCES;
-}
-
-// Free the memory allocated to all process nodes
-static void delete_process_list(void) {
-    struct process_node *curr = process_list;
-    while (curr != NULL) {
-        struct process_node *temp = curr;
-        curr = curr->next;
-        delete_process_node(temp);
-    }
-}
-
 // Open, close, read and write handlers for proc file
 
 // Open handler for proc file
 static int procfile_open(struct inode *inode, struct file *file) {
-    pid_t pid;
-    int ret;
     struct process_node *curr;
 
-    mutex_lock(&mutex);
-
-    pid = current->pid;
-    printk(KERN_INFO "procfile_open() invoked by process %d\n", pid);
-    ret = 0;
+    pr_debug("procfile_open() invoked by process %d\n", current->pid);
 
-    curr = find_process(pid);
+    // Every open gets its own queue, reached through file->private_data
+    curr = create_process_node(current->pid, file);
     if (curr == NULL) {
-        curr = insert_process(pid);
-        if (curr == NULL) {
-            printk(KERN_ALERT "Error: could not allocate memory for process node\n");
-            ret = -ENOMEM;
-        } else {
-            printk(KERN_INFO "Process %d has been added to the process list\n", pid);
-        }
-    } else {
-        printk(KERN_ALERT "Error: process %d has the proc file already open\n", pid);
-        ret = -EACCES;
+        printk(KERN_ALERT "Error: could not allocate memory for process node\n");
+        return -ENOMEM;
     }
-
-    mutex_unlock(&mutex);
-    return ret;
+    file->private_data = curr;
+    pr_debug("Process %d has opened the proc file\n", current->pid);
+    return 0;
 }
 
 // Close handler for proc file
 static int procfile_close(struct inode *inode, struct file *file) {
-    pid_t pid;
-    int ret;
-    struct process_node *curr;
+    pr_debug("procfile_close() invoked by process %d\n", current->pid);
 
-    mutex_lock(&mutex);
+    // Called once for the last reference to the file, no other operation can be running on it
+    delete_process_node(file->private_data);
+    file->private_data = NULL;
+    return 0;
+}
 
-    pid = current->pid;
-    printk(KERN_INFO "procfile_close() invoked by process %d\n", pid);
-    ret = 0;
+// Blocking support, called with the queue lock held
 
-    curr = find_process(pid);
-    if (curr == NULL) {
-        printk(KERN_ALERT "Error: process %d does not have the proc file open\n", pid);
-        ret = -EACCES;
-    } else {
-        delete_process(pid);
-        printk(KERN_INFO "Process %d has been removed from the process list\n", pid);
+// Wake as many readers or writers as the size changed by since the last call, poll()
+// waiters always wake. Called before every release of the lock, so no change is missed.
+static void wake_waiters(struct priority_queue *pq) {
+    if (pq->size > pq->notified_size) {
+        wake_up_interruptible_nr(&pq->readq, pq->size - pq->notified_size);
+    } else if (pq->size < pq->notified_size) {
+        wake_up_interruptible_nr(&pq->writeq, pq->notified_size - pq->size);
     }
+    pq->notified_size = pq->size;
+}
 
-    mutex_unlock(&mutex);
-    return ret;
+// Wait until the queue has an element, only on a file opened with blocking_read set and without O_NONBLOCK
+static int wait_nonempty(struct process_node *curr) {
+    struct priority_queue *pq = curr->proc_pq;
+    int ret;
+
+    while (pq->size == 0) {
+        if (!curr->blocking_read) {
+            pr_debug("Error: priority queue is empty\n");
+            return -EACCES;
+        }
+        if (curr->file->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
+        }
+        wake_waiters(pq);
+        mutex_unlock(&pq->lock);
+        ret = wait_event_interruptible_exclusive(pq->readq, READ_ONCE(pq->size) > 0);
+        mutex_lock(&pq->lock);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
 }
 
-// Helper function to handle reads
-static ssize_t handle_read(struct process_node *curr) {
-    int min_val;
+// Helper function to handle reads: extracts as many elements as fit in the user buffer,
+// in priority order. Each one is copied out before it is extracted, so a fault loses nothing.
+static ssize_t handle_read(struct process_node *curr, char __user *buffer, size_t length) {
+    struct priority_queue *pq = curr->proc_pq;
+    struct pb_record record;
+    size_t size = curr->read_records ? sizeof(struct pb_record) : sizeof(int);
+    size_t n = 0;
+    int ret;
+
     if (curr->state == PROC_FILE_OPEN) {
-        printk(KERN_ALERT "Error: process %d has not yet written anything to the proc file\n", curr->pid);
+        pr_debug("Error: process %d has not yet written anything to the proc file\n", curr->pid);
         return -EACCES;
     }
-    // curr->proc_pq cannot be NULL if the control comes here
-    if (curr->proc_pq->size == 0) {
-        printk(KERN_ALERT "Error: priority queue is empty\n");
-        return -EACCES;
+    if (length < size) {
+        pr_debug("Error: Buffer size for a read must be at least %zu bytes\n", size);
+        return -EINVAL;
+    }
+    ret = wait_nonempty(curr);
+    if (ret < 0) {
+        return ret;
     }
-    min_val = extract_min(curr->proc_pq);
-    strncpy(procfs_buffer, (const char *)&min_val, sizeof(int));
-    procfs_buffer[sizeof(int)] = '\0';
-    procfs_buffer_size = sizeof(int);
-    return procfs_buffer_size;
+    while (n < length / size && pq->size > 0) {
+        // val comes first, so a bare value is a prefix of the record
+        record.val = pq->heap[0].val;
+        record.priority = pq->heap[0].priority;
+        record.insert_time = pq->heap[0].insert_time;
+        if (copy_to_user(buffer + n * size, &record, size) != 0) {
+            pr_debug("Error: could not copy data to user space\n");
+            break;
+        }
+        extract_min(pq);
+        n++;
+    }
+    return n > 0 ? n * size : -EFAULT;
 }
 
 // Read handler for proc file
 static ssize_t procfile_read(struct file *filep, char __user *buffer, size_t length, loff_t *offset) {
-    pid_t pid;
-    int ret;
-    struct process_node *curr;
-    
-    mutex_lock(&mutex);
+    ssize_t ret;
+    struct process_node *curr = filep->private_data;
 
-    pid = current->pid;
-    printk(KERN_INFO "procfile_read() invoked by process %d\n", pid);
-    ret = 0;
+    mutex_lock(&curr->proc_pq->lock);
 
-    curr = find_process(pid);
-    if (curr == NULL) {
-        printk(KERN_ALERT "Error: process %d does not have the proc file open\n", pid);
-        ret = -EACCES;
-    } else {
-        procfs_buffer_size = min(length, (size_t)PROCFS_MAX_SIZE);
-        ret = handle_read(curr);
-        if (ret >= 0) {
-            if (copy_to_user(buffer, procfs_buffer, procfs_buffer_size) != 0) {
-                printk(KERN_ALERT "Error: could not copy data to user space\n");
-                ret = -EACCES;
-            } else {
-                ret = procfs_buffer_size;
-            }
-        }
-        print_pq(curr->proc_pq);
-    }
-    mutex_unlock(&mutex);
+    pr_debug("procfile_read() invoked by process %d\n", current->pid);
+    ret = handle_read(curr, buffer, length);
+    wake_waiters(curr->proc_pq);
+    print_pq(curr->proc_pq);
+    mutex_unlock(&curr->proc_pq->lock);
     return ret;
 }
 
-// Helper function to handle writes
-static ssize_t handle_write(struct process_node *curr) {
-    size_t capacity;
-    int value, priority, ret;
+// Helper function to handle writes of at most one int, data holds the size bytes written
+static ssize_t handle_write(struct process_node *curr, const char *data, size_t size) {
+    int capacity, value, priority, ret;
 
     if (curr->state == PROC_FILE_OPEN) {
-        if (procfs_buffer_size > 1ul) {
-            printk(KERN_ALERT "Error: Buffer size for capacity must be 1 byte\n");
+        // A 1-byte capacity is unsigned, a 4-byte one can also be PQ_UNBOUNDED
+        if (size == 1ul) {
+            capacity = (unsigned char)data[0];
+        } else if (size == 4ul) {  // sizeof(int)
+            capacity = *((int *)data);
+        } else {
+            pr_debug("Error: Buffer size for capacity must be 1 or 4 bytes\n");
             return -EINVAL;
         }
-        capacity = (size_t)procfs_buffer[0];
-        if (capacity < 1 || capacity > 100) {
-            printk(KERN_ALERT "Error: Capacity must be between 1 and 100\n");
+        if (!pq_valid_capacity(capacity)) {
+            pr_debug("Error: Capacity must be between 1 and %d, or %d for an unbounded queue\n", PQ_MAX_CAPACITY, PQ_UNBOUNDED);
             return -EINVAL;
         }
-        curr->proc_pq = create_pq(capacity);
-        if (curr->proc_pq == NULL) {
+        if (reset_pq(curr->proc_pq, capacity) < 0) {
             printk(KERN_ALERT "Error: priority queue initialization failed\n");
             return -ENOMEM;
         }
-        printk(KERN_INFO "Priority queue with capacity %zu has been intialized for process %d\n", capacity, curr->pid);
+        pr_debug("Priority queue with capacity %d has been intialized for process %d\n", capacity, curr->pid);
         curr->state = PROC_READ_VALUE;
     } else if (curr->state == PROC_READ_VALUE) {
-        if (procfs_buffer_size > 4ul) {  // sizeof(int)
-            printk(KERN_ALERT "Error: Buffer size for value must be 4 bytes\n");
+        if (size > 4ul) {  // sizeof(int)
+            pr_debug("Error: Buffer size for value must be 4 bytes\n");
             return -EINVAL;
         }
-        if (curr->proc_pq->size == curr->proc_pq->capacity) {
-            printk(KERN_ALERT "Error: priority queue is full\n");
+        if (pq_full(curr->proc_pq)) {
+            pr_debug("Error: priority queue is full\n");
             return -EACCES;
         }
-        value = *((int *)procfs_buffer);
+        value = *((int *)data);
         curr->proc_pq->last_value = value;
-        printk(KERN_INFO "Value %d has been written to the proc file for process %d\n", value, curr->pid);
+        pr_debug("Value %d has been written to the proc file for process %d\n", value, curr->pid);
         curr->state = PROC_READ_PRIORITY;
     } else if (curr->state == PROC_READ_PRIORITY) {
-        if (procfs_buffer_size > 4ul) {  // sizeof(int)
-            printk(KERN_ALERT "Error: Buffer size for priority must be 4 bytes\n");
+        if (size > 4ul) {  // sizeof(int)
+            pr_debug("Error: Buffer size for priority must be 4 bytes\n");
             return -EINVAL;
         }
-        if (curr->proc_pq->size == curr->proc_pq->capacity) {
-            printk(KERN_ALERT "Error: priority queue is full\n");
+        if (pq_full(curr->proc_pq)) {
+            pr_debug("Error: priority queue is full\n");
             return -EACCES;
         }
-        priority = *((int *)procfs_buffer);
+        priority = *((int *)data);
         if (priority < 1) {
-            printk(KERN_ALERT "Error: Priority must be a positive integer\n");
+            pr_debug("Error: Priority must be a positive integer\n");
             return -EINVAL;
         }
-        printk(KERN_INFO "Priority %d has been written to the proc file for process %d\n", priority, curr->pid);
+        pr_debug("Priority %d has been written to the proc file for process %d\n", priority, curr->pid);
         ret = insert_pq(curr->proc_pq, curr->proc_pq->last_value, priority);
         if (ret < 0) {
-            printk(KERN_ALERT "Error: priority queue insertion failed\n");
-            return -EACCES;
+            pr_debug("Error: priority queue insertion failed\n");
+            return ret;
         }
-        printk(KERN_INFO "(%d, %d) value-priority element has been inserted into the priority queue for process %d\n", curr->proc_pq->last_value, priority, curr->pid);
+        pr_debug("(%d, %d) value-priority element has been inserted into the priority queue for process %d\n", curr->proc_pq->last_value, priority, curr->pid);
         curr->state = PROC_READ_VALUE;
     }
-    return procfs_buffer_size;
+    return size;
+}
+
+// Insert the {value, priority} records of a write longer than one int, copied in
+// PB_RECORD_WINDOW records at a time. Like a short write to a pipe,
+// a write that inserted some of its records returns their size and the caller can retry
+// the rest; only a write that inserted nothing returns the error.
+static ssize_t handle_records(struct process_node *curr, const char __user *buffer, size_t length) {
+    struct priority_queue *pq = curr->proc_pq;
+    int records[2 * PB_RECORD_WINDOW];
+    size_t done = 0, window, i;
+    int ret = 0;
+
+    if (length % PB_RECORD_SIZE != 0) {
+        pr_debug("Error: Buffer size for records must be a multiple of %d bytes\n", PB_RECORD_SIZE);
+        return -EINVAL;
+    }
+    while (done < length && ret == 0) {
+        window = min(length - done, sizeof(records));
+        if (copy_from_user(records, buffer + done, window)) {
+            pr_debug("Error: could not copy from user\n");
+            ret = -EFAULT;
+            break;
+        }
+        // Grow the heap once for all the records of the window that fit
+        if (reserve_pq(pq, min(pq->size + (int)(window / PB_RECORD_SIZE), pq_limit(pq))) < 0) {
+            ret = -ENOMEM;
+            break;
+        }
+        for (i = 0; i < window / PB_RECORD_SIZE; i++) {
+            if (records[2 * i + 1] < 1) {
+                pr_debug("Error: Priority must be a positive integer\n");
+                ret = -EINVAL;
+                break;
+            }
+            ret = insert_pq(pq, records[2 * i], records[2 * i + 1]);
+            if (ret < 0) {
+                break;
+            }
+            done += PB_RECORD_SIZE;
+        }
+    }
+    pr_debug("%zu records have been inserted into the priority queue for process %d\n", done / PB_RECORD_SIZE, curr->pid);
+    return done > 0 ? done : ret;
 }
 
 // Write handler for proc file
 static ssize_t procfile_write(struct file *filep, const char __user *buffer, size_t length, loff_t *offset) {
-    pid_t pid;
-    int ret;
-    struct process_node *curr;
-    
-    mutex_lock(&mutex);
-
-    pid = current->pid;
-    printk(KERN_INFO "procfile_write() invoked by process %d\n", pid);
-    ret = 0;
-
-    curr = find_process(pid);
-    if (curr == NULL) {
-        printk(KERN_ALERT "Error: process %d does not have the proc file open\n", pid);
-        ret = -EACCES;
+    ssize_t ret;
+    struct process_node *curr = filep->private_data;
+    int data = 0;
+
+    mutex_lock(&curr->proc_pq->lock);
+
+    pr_debug("procfile_write() invoked by process %d\n", current->pid);
+    if (buffer == NULL || length == 0) {
+        pr_debug("Error: empty write\n");
+        ret = -EINVAL;
+    } else if (curr->state == PROC_READ_VALUE && length > sizeof(int)) {
+        // One or more whole records instead of a lone value
+        ret = handle_records(curr, buffer, length);
+    } else if (copy_from_user(&data, buffer, min(length, sizeof(int)))) {
+        pr_debug("Error: could not copy from user\n");
+        ret = -EFAULT;
     } else {
-        if (buffer == NULL || length == 0) {
-            printk(KERN_ALERT "Error: empty write\n");
-            ret = -EINVAL;
-        } else {
-            procfs_buffer_size = min(length, (size_t)PROCFS_MAX_SIZE);
-            if (copy_from_user(procfs_buffer, buffer, procfs_buffer_size)) {
-                printk(KERN_ALERT "Error: could not copy from user\n");
-                ret = -EFAULT;
-            } else {
-                ret = handle_write(curr);
-            }
-        }
-        print_pq(curr->proc_pq);
+        // Longer writes are rejected by handle_write() on their size
+        ret = handle_write(curr, (const char *)&data, length);
     }
-    mutex_unlock(&mutex);
+    wake_waiters(curr->proc_pq);
+    print_pq(curr->proc_pq);
+    mutex_unlock(&curr->proc_pq->lock);
     return ret;
 }
 
+// Readable when the queue has an element, writable when it has free space
+static __poll_t procfile_poll(struct file *filep, poll_table *wait) {
+    struct process_node *curr = filep->private_data;
+    struct priority_queue *pq = curr->proc_pq;
+    __poll_t mask = 0;
+
+    poll_wait(filep, &pq->readq, wait);
+    poll_wait(filep, &pq->writeq, wait);
+    // Racy reads are fine, a change that happens after them wakes the poll table
+    if (READ_ONCE(curr->state) != PROC_FILE_OPEN) {
+        if (READ_ONCE(pq->size) > 0) {
+            mask |= EPOLLIN | EPOLLRDNORM;
+        }
+        if (READ_ONCE(pq->size) < pq_limit(pq)) {
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        }
+    }
+    return mask;
+}
+
 static const struct proc_ops proc_fops = {
     .proc_open = procfile_open,
     .proc_read = procfile_read,
     .proc_write = procfile_write,
+    .proc_poll = procfile_poll,
     .proc_release = procfile_close,
 };
 
@@ -454,7 +533,7 @@ static int __init lkm_init(void) {
 
 // Module cleanup
 static void __exit lkm_exit(void) {
-    delete_process_list();
+    // Removing the entry releases the files that are still open, which frees their queues
     remove_proc_entry(PROCFS_NAME, NULL);
     printk(KERN_INFO "/proc/%s removed\n", PROCFS_NAME);
     printk(KERN_INFO "LKM for partb_1_3 unloaded\n");
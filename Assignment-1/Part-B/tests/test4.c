@@ -0,0 +1,51 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wait.h>
+
+struct record {
+    int val;
+    int prio;
+};
+
+// Several {value, priority} records per write() instead of two writes per element
+void execute(struct record rec[], int n) {
+    int fd = open("/proc/partb_1_3", O_RDWR);
+    printf("fd: %d\n", fd);
+    char c = (char)(n - 1);
+    int ret;
+    if ((ret = write(fd, &c, 1)) < 0) {
+        printf("Error, return value: %d\n", ret);
+        return;
+    }
+
+    // Only n - 1 records fit, the write is short by one record
+    ret = write(fd, rec, n * sizeof(struct record));
+    printf("[Proc %d] Write of %d records, Return: %d\n", getpid(), n, ret);
+    ret = write(fd, &rec[n - 1], sizeof(struct record));
+    printf("[Proc %d] Write to full queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    for (int i = 0; i < n - 1; i++) {
+        int out;
+        int ret = read(fd, &out, sizeof(int));
+        printf("[Proc %d] Read: %d, Return: %d\n", getpid(), out, ret);
+    }
+
+    // A lone value still starts the two-write protocol
+    int val = 42, prio = 1, out;
+    write(fd, &val, sizeof(int));
+    write(fd, &prio, sizeof(int));
+    ret = read(fd, &out, sizeof(int));
+    printf("[Proc %d] Read: %d, Return: %d\n", getpid(), out, ret);
+    close(fd);
+}
+
+int main() {
+    struct record rec[] = {{10, 3}, {11, 1}, {12, 2}, {13, 1}, {14, 5}};
+
+    execute(rec, sizeof(rec) / sizeof(struct record));
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wait.h>
+
+struct record {
+    int val;
+    int prio;
+};
+
+// One read() drains as many values as fit in its buffer, in priority order
+void execute(struct record rec[], int n) {
+    int fd = open("/proc/partb_1_3", O_RDWR);
+    printf("fd: %d\n", fd);
+    char c = (char)n;
+    int ret;
+    if ((ret = write(fd, &c, 1)) < 0) {
+        printf("Error, return value: %d\n", ret);
+        return;
+    }
+    ret = write(fd, rec, n * sizeof(struct record));
+    printf("[Proc %d] Write of %d records, Return: %d\n", getpid(), n, ret);
+
+    int out[8];
+    ret = read(fd, out, 3 * sizeof(int));
+    printf("[Proc %d] Read of 3 values, Return: %d:", getpid(), ret);
+    for (int i = 0; i < ret / (int)sizeof(int); i++) {
+        printf(" %d", out[i]);
+    }
+    printf("\n");
+
+    // Only the remaining values are returned
+    ret = read(fd, out, sizeof(out));
+    printf("[Proc %d] Read of up to 8 values, Return: %d:", getpid(), ret);
+    for (int i = 0; i < ret / (int)sizeof(int); i++) {
+        printf(" %d", out[i]);
+    }
+    printf("\n");
+
+    ret = read(fd, out, sizeof(out));
+    printf("[Proc %d] Read from empty queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    close(fd);
+}
+
+int main() {
+    struct record rec[] = {{10, 3}, {11, 1}, {12, 2}, {13, 1}, {14, 5}};
+
+    execute(rec, sizeof(rec) / sizeof(struct record));
+
+    return 0;
+}
@@ -3,23 +3,55 @@
     Vanshita Garg - 19CS10064
 */
 
+// Per-operation messages use pr_debug(), which compiles to nothing unless the
+// module is built with DEBUG or enabled at runtime through dynamic debug
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/atomic.h>
+#include <linux/bitmap.h>
 #include <linux/errno.h>
+#include <linux/file.h>
 #include <linux/init.h>
+#include <linux/jiffies.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/lockdep.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
 #include <linux/proc_fs.h>
+#include <linux/random.h>
 #include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/spinlock.h>
 #include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/xarray.h>
+
+#include "../common/pq_heap.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Vanshita Garg and Ashutosh Kumar Singh");
 MODULE_DESCRIPTION("LKM for a priority queue");
 MODULE_VERSION("0.1");
 
+static int relaxed_factor = 2;
+module_param(relaxed_factor, int, 0444);
+MODULE_PARM_DESC(relaxed_factor, "Sub-heaps per CPU in a relaxed named queue");
+
 #define PROCFS_NAME "cs60038_a2_grp3"
+#define STATS_NAME "cs60038_a2_grp3_stats"
 
 #define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
 #define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
@@ -27,464 +59,3011 @@ MODULE_VERSION("0.1");
 #define PB2_GET_INFO _IOR(0x10, 0x34, int32_t *)
 #define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
 #define PB2_GET_MAX _IOR(0x10, 0x36, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_GET_MIN_N _IOWR(0x10, 0x38, struct pb2_drain *)
+#define PB2_GET_MAX_N _IOWR(0x10, 0x39, struct pb2_drain *)
+#define PB2_GET_INFO_EXT _IOR(0x10, 0x3a, struct obj_info_ext *)
+#define PB2_SETUP_RING _IOWR(0x10, 0x3b, struct pb2_ring_params *)
+#define PB2_RING_ENTER _IO(0x10, 0x3c)
+#define PB2_SET_MODE _IOW(0x10, 0x3d, int32_t *)
+#define PB2_INSERT_TIMED _IOW(0x10, 0x3e, struct pb2_timed_insert *)
+#define PB2_ATTACH _IOW(0x10, 0x3f, struct pb2_attach *)
+#define PB2_SET_BACKEND _IOW(0x10, 0x40, int32_t *)
+#define PB2_INSERT_HANDLE _IOWR(0x10, 0x41, struct pb2_handle_insert *)
+#define PB2_UPDATE_PRIO _IOW(0x10, 0x42, struct pb2_update *)
+#define PB2_DELETE _IOW(0x10, 0x43, int64_t *)
+#define PB2_BULK_LOAD _IOWR(0x10, 0x44, struct pb2_batch *)
+#define PB2_MELD _IOW(0x10, 0x45, int32_t *)
+
+// PB2_SET_MODE flags, per open file
+#define PB2_MODE_BLOCK_READ 0x1   // extractions wait for an element instead of failing on an empty queue
+#define PB2_MODE_BLOCK_WRITE 0x2  // insertions wait for free space instead of failing on a full queue
+#define PB2_MODE_COMBINE 0x4      // single inserts and extractions are combined, see combine()
+
+// pb2_attach flags
+#define PB2_ATTACH_CREATE 0x1  // create the named queue if it does not exist yet
+#define PB2_ATTACH_EXCL 0x2    // fail with -EEXIST if the named queue already exists
+#define PB2_ATTACH_RELAXED 0x4 // a queue created by this call is relaxed, see relaxed_extract()
+
+#define PB2_NAME_LEN 32  // including the terminating NUL
+
+// PB2_SET_BACKEND heap implementations
+#define PB2_BACKEND_MINMAX 0  // min-max heap of struct element from pq_heap.h, the default
+#define PB2_BACKEND_DARY 1    // 4-ary min-heap of packed keys, faster GET_MIN but O(n) GET_MAX
+#define PB2_BACKEND_PAIRING 2 // pairing heap of nodes, O(1) PB2_MELD but O(n) GET_MAX
+#define PB2_BACKEND_BUCKET 3  // FIFO per priority, O(1) inserts and fast GET_MIN and GET_MAX, priorities up to PQ_BUCKET_PRIOS
+
+// pb2_sqe opcodes
+#define PB2_OP_INSERT 1   // insert (val, priority)
+#define PB2_OP_GET_MIN 2  // extract the minimum element
+#define PB2_OP_GET_MAX 3  // extract the maximum element
+
+#define PB2_RING_MAX_ENTRIES 32768
+
+// pb2_drain flags
+#define PB2_DRAIN_RECORDS 0x1  // fill the buffer with struct pb2_record instead of int32_t values
+
+#define DARY_ARITY 4               // children per node of a PB2_BACKEND_DARY heap
+#define DARY_PAD (DARY_ARITY - 1)  // unused keys before the root, see dary_resize()
+#define PQ_BUCKET_PRIOS 4096       // priorities 1 .. PQ_BUCKET_PRIOS of a PB2_BACKEND_BUCKET queue
+#define PQ_RELAXED_RUN 32          // elements of a batch put into one sub-heap of a relaxed queue
+#define PQ_NEED_LOCK 1             // returned by lock-free paths that cannot handle a request
+#define POOL_MIN_ORDER 8           // smallest recycled heap array, 256 bytes
+#define POOL_MAX_ORDER 18          // largest recycled heap array, 256 KiB
+#define POOL_DEPTH 4               // recycled heap arrays kept per size class
+#define PB2_CMD_FIRST 0x31         // _IOC_NR of the first ioctl, PB2_SET_CAPACITY
+#define PB2_NR_CMDS 21             // ioctls from PB2_SET_CAPACITY to PB2_MELD
+#define HIST_BUCKETS 32            // latency buckets up to 2^30 ns, the last one takes the rest
+#define FC_SPINS 256               // polls of a published request before sleeping on the queue lock
+
+// A node of a PB2_BACKEND_PAIRING heap
+struct pq_node {
+    struct element elem;
+    struct pq_node *child;  // first child
+    struct pq_node *next;   // next sibling, or next spare node
+    struct pq_node *prev;   // previous sibling, or the parent of a first child
+    int shift;              // PB2_BACKEND_PAIRING: still to be added to the insert times of all descendants
+};
+
+// Storage of a PB2_BACKEND_BUCKET queue, whose elements are pq_nodes linked through next and prev
+struct pq_buckets {
+    DECLARE_BITMAP(map, PQ_BUCKET_PRIOS);   // bit p - 1 is set when priority p has elements
+    struct pq_node *head[PQ_BUCKET_PRIOS];  // oldest node of the circular FIFO of each priority
+};
+
+// Event counters, kept per CPU so that counting never bounces a shared cache line
+enum pq_stat {
+    STAT_INSERTS,       // elements added to a heap
+    STAT_EXTRACTS,      // elements removed from a heap, by extraction, PB2_DELETE or PB2_MELD
+    STAT_FULL,          // insertions rejected because the queue was full
+    STAT_EMPTY,         // extractions rejected because the queue was empty
+    STAT_PEAK,          // largest number of elements in one queue, the maximum over CPUs
+    STAT_MEMORY,        // bytes of heap arrays, pairing nodes and handle tables, kept in pq->memory per queue
+    STAT_LOCK_WAITS,    // queue locks that were contended
+    STAT_LOCK_WAIT_NS,  // time spent waiting for them
+    STAT_COMBINED,      // PB2_MODE_COMBINE requests served by a combining lock holder
+    NR_STATS
+};
+
+struct pq_counters {
+    s64 count[NR_STATS];
+};
 
-struct element {
-    int val;
-    int priority;
-    int insert_time;
+// Log2 histograms of the time spent in each ioctl, bucket b counts calls of at most 2^b ns
+struct pq_latency {
+    u64 hist[PB2_NR_CMDS][HIST_BUCKETS];
+    u64 sum[PB2_NR_CMDS];  // total ns
 };
 
+// A queue is either private to one open file, shared by the threads using that file,
+// or a named queue shared by every file attached to it. Batch and timed inserts do not
+// take its lock: they reserve their slots in count and push a chunk of elements onto
+// staged, and whoever takes the lock next merges the staged chunks into the heap. Only
+// consumers and the other operations serialize on the lock, so producers make progress
+// in parallel with them.
 struct priority_queue {
-    struct element *heap;
+    struct mutex lock;  // serializes all operations on the heap and the process nodes using it
+    wait_queue_head_t readq;   // consumers waiting for an element
+    wait_queue_head_t writeq;  // producers waiting for free space
+    int backend;  // PB2_BACKEND_*
+    struct element *heap;  // PB2_BACKEND_MINMAX storage
+    void *dary;            // PB2_BACKEND_DARY storage, holding the keys and vals arrays
+    u64 *keys;
+    int *vals;
+    struct pq_node *root;   // PB2_BACKEND_PAIRING storage
+    struct pq_node *spare;  // PB2_BACKEND_PAIRING and PB2_BACKEND_BUCKET nodes allocated for future inserts
+    struct pq_buckets *buckets;  // PB2_BACKEND_BUCKET storage
     int size;
-    int capacity;
-    int last_value;
-    int timer;
+    int alloc;          // number of elements the heap array can hold, or size plus spare nodes
+    int notified_size;  // size when waiters were last woken
+    int space_waiters;  // producers sleeping in wait_space(), newcomers queue behind them
+    int capacity;       // maximum number of elements, or PQ_UNBOUNDED
+    struct pq_handle *handles;  // handles given out by PB2_INSERT_HANDLE
+    int nr_handles;
+    int free_handle;    // first unused entry of handles, -1 if none
+    long memory;        // bytes allocated for elements, nodes and handles, see mem_add()
+    atomic_t count;     // elements in the heap or staged, insertions reserve their slot here first
+    atomic_t timer;     // next insert time
+    struct llist_head staged;  // struct pb2_chunk lists inserted without the lock
+    struct kref ref;           // named queues: one reference per attached file
+    struct list_head list;     // named queues: entry in named_queues
+    char name[PB2_NAME_LEN];   // empty for a private queue
+    struct priority_queue *subs;  // relaxed queues: the sub-heaps holding the elements, NULL otherwise
+    int nr_subs;
+    u64 min_key;  // sub-heaps: sort keys of the minimum and maximum element, read without the lock
+    u64 max_key;
+    struct pq_counters __percpu *stats;  // named queues and their sub-heaps, NULL for a private queue
+    struct pb2_fc_slot __percpu *fc_slots;  // PB2_MODE_COMBINE requests, NULL until a file uses that mode
 };
 
-// Comparison first based on priority and then on insert time
-int compare(struct element *a, struct element *b) {
-    if (a->priority < b->priority) {
-        return 1;
-    } else if (a->priority > b->priority) {
-        return 0;
-    } else {
-        return a->insert_time < b->insert_time;
-    }
+// Priority and insert time packed so that integer order is compare() order
+static u64 pack_key(int priority, int insert_time) {
+    return (u64)(u32)priority << 32 | (u32)insert_time;
 }
 
 enum proc_state {
     PROC_FILE_OPEN,
-    PROC_READ_VALUE,
-    PROC_READ_PRIORITY,
+    PROC_READ_VALUE,  // the capacity is set, see pending for the PB2_INSERT_INT protocol
 };
 
-// Linked list of processes
+// Per open file state, stored in file->private_data and protected by proc_pq->lock.
+// Every thread of the process may use the file concurrently: the state is per file,
+// only a value sent by PB2_INSERT_INT is kept per thread until its priority follows.
 struct process_node {
-    pid_t pid;
+    pid_t pid;  // process that opened the proc file
+    struct file *file;
     enum proc_state state;
-    struct priority_queue *proc_pq;
-    struct process_node *next;
+    int mode;        // PB2_MODE_* flags
+    struct xarray pending;  // values of PB2_INSERT_INT waiting for their priority, by thread id
+    struct priority_queue *proc_pq;  // own_pq, or the named queue after PB2_ATTACH
+    struct priority_queue *own_pq;   // allocated at open, lives as long as the file
+    struct pb2_ring *ring;           // set up by PB2_SETUP_RING, NULL otherwise
+    wait_queue_head_t pollq;         // pollers of the file, see procfile_poll()
+    struct wait_queue_entry poll_read, poll_write;  // pass wakeups of proc_pq on to pollq once polled
+    int polled;                      // whether poll_read and poll_write are on the wait queues of proc_pq
 };
 
 // Global variables
 static struct proc_dir_entry *proc_file;
-static struct process_node *process_list = NULL;
+static LIST_HEAD(named_queues);     // named queues with at least one attached file
+static DEFINE_MUTEX(named_lock);    // protects named_queues and their reference counts
+static struct kmem_cache *node_cache;     // struct process_node, one per open
+static struct kmem_cache *pq_cache;       // struct priority_queue, one per open and named queue
+static struct kmem_cache *pq_node_cache;  // struct pq_node of the pairing heaps
+static struct lock_class_key sub_lock_key;  // lockdep class of relaxed sub-heaps, see create_subs()
+static DEFINE_SPINLOCK(pool_lock);        // protects pool and pool_count
+static void *pool[POOL_MAX_ORDER - POOL_MIN_ORDER + 1][POOL_DEPTH];  // recycled heap arrays, see pool_alloc()
+static int pool_count[POOL_MAX_ORDER - POOL_MIN_ORDER + 1];
+static DEFINE_PER_CPU(struct pq_counters, global_stats);  // every queue, see stats_show()
+static DEFINE_PER_CPU(struct pq_latency, latency);
 
-DEFINE_MUTEX(mutex);
-
-struct obj_info {
-    int32_t prio_que_size;  // current number of elements in priority queue
-    int32_t capacity;       // maximum capacity of priority queue
+static const char *const stat_names[NR_STATS] = {
+    [STAT_INSERTS] = "inserts_total",
+    [STAT_EXTRACTS] = "extracts_total",
+    [STAT_FULL] = "full_rejections_total",
+    [STAT_EMPTY] = "empty_rejections_total",
+    [STAT_PEAK] = "peak_size",
+    [STAT_MEMORY] = "memory_bytes",
+    [STAT_LOCK_WAITS] = "lock_waits_total",
+    [STAT_LOCK_WAIT_NS] = "lock_wait_ns_total",
+    [STAT_COMBINED] = "combined_total",
 };
 
-// Priority queue functions
+static const char *const cmd_names[PB2_NR_CMDS] = {
+    "SET_CAPACITY", "INSERT_INT", "INSERT_PRIO", "GET_INFO", "GET_MIN", "GET_MAX", "INSERT_BATCH",
+    "GET_MIN_N", "GET_MAX_N", "GET_INFO_EXT", "SETUP_RING", "RING_ENTER", "SET_MODE", "INSERT_TIMED",
+    "ATTACH", "SET_BACKEND", "INSERT_HANDLE", "UPDATE_PRIO", "DELETE", "BULK_LOAD", "MELD",
+};
 
-// Initialize the priority queue
-static struct priority_queue *create_pq(int capacity) {
-    struct priority_queue *pq = kmalloc(sizeof(struct priority_queue), GFP_KERNEL);
-    if (pq == NULL) {
-        printk(KERN_ALERT "Error: could not allocate memory for priority queue\n");
-        return NULL;
-    }
-    pq->heap = kmalloc(capacity * sizeof(struct element), GFP_KERNEL);
-    if (pq->heap == NULL) {
-        printk(KERN_ALERT "Error: could not allocate memory for priority queue heap array\n");
-        return NULL;
+// Count n events on the global counters and on those of pq, which may be NULL
+static void stat_add(struct priority_queue *pq, int stat, s64 n) {
+    this_cpu_add(global_stats.count[stat], n);
+    if (pq != NULL && pq->stats != NULL) {
+        this_cpu_add(pq->stats->count[stat], n);
     }
-    pq->size = 0;
-    pq->capacity = capacity;
-    pq->last_value = 0;
-    pq->timer = 0;
-    return pq;
 }
 
-static void shift_up(struct priority_queue *pq, int i) {
-    while (i > 0 && compare(&pq->heap[i], &pq->heap[(i - 1) / 2])) {
-        struct element temp = pq->heap[i];
-        pq->heap[i] = pq->heap[(i - 1) / 2];
-        pq->heap[(i - 1) / 2] = temp;
-        i = (i - 1) / 2;
+static void stat_max(struct pq_counters __percpu *stats, int stat, s64 value) {
+    struct pq_counters *c = get_cpu_ptr(stats);
+    if (value > c->count[stat]) {
+        c->count[stat] = value;
     }
+    put_cpu_ptr(stats);
 }
 
-static void shift_down(struct priority_queue *pq, int i) {
-    int left, right, min_child;
-    while (i < pq->size) {
-        left = 2 * i + 1;
-        right = 2 * i + 2;
-        if (left >= pq->size) {
-            break;
-        }
-        min_child = left;
-        if (right < pq->size && compare(&pq->heap[right], &pq->heap[left])) {
-            min_child = right;
-        }
-        if (!compare(&pq->heap[i], &pq->heap[min_child])) {
-            struct element temp = pq->heap[i];
-            pq->heap[i] = pq->heap[min_child];
-            pq->heap[min_child] = temp;
-            i = min_child;
-        } else {
-            break;
-        }
+// Sum of a counter over all CPUs, or their maximum for STAT_PEAK
+static s64 stat_read(struct pq_counters __percpu *stats, int stat) {
+    s64 total = 0, v;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        v = per_cpu_ptr(stats, cpu)->count[stat];
+        total = stat == STAT_PEAK ? max(total, v) : total + v;
     }
+    return total;
 }
 
-// Insert an element into the priority queue
-static int insert(struct priority_queue *pq, int val, int priority) {
-    if (pq->size == pq->capacity) {
-        printk(KERN_ALERT "Error: priority queue is full\n");
-        return -EACCES;
+// Take the lock of a queue, timing the wait only when it is contended
+static void lock_queue(struct priority_queue *pq) {
+    u64 start;
+
+    if (mutex_trylock(&pq->lock)) {
+        return;
     }
-    pq->heap[pq->size].val = val;
-    pq->heap[pq->size].priority = priority;
-    pq->heap[pq->size].insert_time = pq->timer;
-    pq->timer++;
+    start = ktime_get_ns();
+    mutex_lock(&pq->lock);
+    stat_add(pq, STAT_LOCK_WAITS, 1);
+    stat_add(pq, STAT_LOCK_WAIT_NS, ktime_get_ns() - start);
+}
 
-    shift_up(pq, pq->size);
-    pq->size++;
-    return 0;
+struct obj_info {
+    int32_t prio_que_size;  // current number of elements in priority queue
+    int32_t capacity;       // maximum capacity of priority queue
+};
+
+struct obj_info_ext {
+    int32_t prio_que_size;  // current number of elements in priority queue
+    int32_t capacity;       // maximum capacity of priority queue, PQ_UNBOUNDED if unlimited
+    int64_t allocated;      // number of elements the heap array can currently hold
+    int64_t footprint;      // bytes allocated for the queue and its heap array
+};
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;  // user array of value-priority pairs
+    int32_t count;           // number of pairs in the array
+    int32_t accepted;        // set to the number of pairs inserted
+};
+
+// Elements staged by a producer, their insert times are first_time onwards
+struct pb2_chunk {
+    struct llist_node node;
+    int n;
+    int first_time;
+    struct pb2_pair pairs[];
+};
+
+struct pb2_attach {
+    char name[PB2_NAME_LEN];  // name of the queue, NUL terminated
+    int32_t capacity;         // capacity of a queue created by this call, as for PB2_SET_CAPACITY
+    int32_t flags;            // PB2_ATTACH_* flags
+};
+
+struct pb2_timed_insert {
+    int32_t val;
+    int32_t priority;
+    int32_t timeout_ms;  // how long to wait for free space, -ETIMEDOUT after that
+};
+
+struct pb2_handle_insert {
+    int32_t val;
+    int32_t priority;
+    int64_t handle;  // set to a handle of the element for PB2_UPDATE_PRIO and PB2_DELETE
+};
+
+struct pb2_update {
+    int64_t handle;
+    int32_t priority;  // new priority of the element
+    int32_t pad;
+};
+
+struct pb2_record {
+    int32_t val;
+    int32_t priority;
+    int32_t insert_time;
+};
+
+struct pb2_drain {
+    void *buf;          // user buffer for count values or records
+    int32_t count;      // maximum number of elements to extract
+    int32_t flags;      // PB2_DRAIN_* flags
+    int32_t extracted;  // set to the number of elements extracted
+};
+
+// Submission/completion rings shared with user space through mmap() on the proc file.
+// The mapping starts with a struct pb2_ring_hdr followed by the sqe and cqe arrays at
+// the offsets returned by PB2_SETUP_RING. User space fills sqes and advances sq_tail,
+// PB2_RING_ENTER consumes them, posts one cqe each and advances sq_head and cq_tail.
+// An sqe is only consumed when its cqe has room, so completions are never dropped.
+struct pb2_ring_params {
+    uint32_t sq_entries;  // in: submission ring size, rounded up to a power of two
+    uint32_t cq_entries;  // in: completion ring size, 0 for twice sq_entries
+    uint32_t sq_off;      // out: offset of the sqe array in the mapping
+    uint32_t cq_off;      // out: offset of the cqe array in the mapping
+    uint32_t ring_size;   // out: number of bytes to mmap()
+};
+
+struct pb2_ring_hdr {
+    uint32_t sq_head;  // written by the kernel
+    uint32_t sq_tail;  // written by user space
+    uint32_t cq_head;  // written by user space
+    uint32_t cq_tail;  // written by the kernel
+    uint32_t sq_mask;
+    uint32_t cq_mask;
+};
+
+struct pb2_sqe {
+    uint32_t opcode;  // PB2_OP_*
+    int32_t val;
+    int32_t priority;
+    uint32_t pad;
+    uint64_t user_data;  // copied to the cqe
+};
+
+struct pb2_cqe {
+    uint64_t user_data;
+    int32_t res;  // 0 or a negative errno, as the equivalent ioctl would return
+    int32_t val;  // the extracted element for PB2_OP_GET_MIN and PB2_OP_GET_MAX
+    int32_t priority;
+    int32_t insert_time;
+};
+
+struct pb2_ring {
+    void *mem;  // vmalloc_user() area mapped by user space
+    struct pb2_ring_hdr *hdr;
+    struct pb2_sqe *sqes;
+    struct pb2_cqe *cqes;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_head;  // private copies of the indices owned by the kernel, the
+    uint32_t cq_tail;  // shared ones are only written, never trusted
+};
+
+enum fc_state {
+    FC_FREE,     // the slot can be claimed
+    FC_FILLING,  // claimed by a thread that is writing its request
+    FC_PENDING,  // published, waiting for a combiner
+    FC_DONE,     // served, the owner has yet to read cqe
+};
+
+// A PB2_MODE_COMBINE request published by a thread, one slot per CPU and queue
+struct pb2_fc_slot {
+    int state;  // enum fc_state
+    struct pb2_sqe sqe;
+    struct pb2_cqe cqe;
+};
+
+// A producer sleeping in wait_space(), a wakeup that hands it a slot sets granted
+struct space_wait {
+    wait_queue_entry_t wait;
+    int granted;
+};
+
+// Slots handed out by one wakeup of writeq, passed as its key, see release_slots()
+struct space_grant {
+    int left;
+};
+
+// Priority queue functions
+
+static void init_pq(struct priority_queue *pq) {
+    mutex_init(&pq->lock);
+    init_waitqueue_head(&pq->readq);
+    init_waitqueue_head(&pq->writeq);
+    pq->backend = PB2_BACKEND_MINMAX;
+    pq->heap = NULL;
+    pq->dary = NULL;
+    pq->keys = NULL;
+    pq->vals = NULL;
+    pq->root = NULL;
+    pq->spare = NULL;
+    pq->buckets = NULL;
+    pq->size = 0;
+    pq->alloc = 0;
+    pq->notified_size = 0;
+    pq->space_waiters = 0;
+    pq->capacity = 0;
+    pq->handles = NULL;
+    pq->nr_handles = 0;
+    pq->free_handle = -1;
+    pq->memory = 0;
+    atomic_set(&pq->count, 0);
+    atomic_set(&pq->timer, 0);
+    init_llist_head(&pq->staged);
+    kref_init(&pq->ref);
+    INIT_LIST_HEAD(&pq->list);
+    pq->name[0] = '\0';
+    pq->subs = NULL;
+    pq->nr_subs = 0;
+    pq->min_key = U64_MAX;
+    pq->max_key = 0;
+    pq->stats = NULL;
+    pq->fc_slots = NULL;
 }
 
-// Extract the minimum element from the priority queue
-static int extract_min(struct priority_queue *pq, struct element *min_elem) {
-    if (pq->size == 0) {
-        printk(KERN_ALERT "Error: priority queue is empty\n");
-        return -EACCES;
+// Allocate an empty priority queue, its heap is allocated once the capacity is set
+static struct priority_queue *create_pq(void) {
+    struct priority_queue *pq = kmem_cache_alloc(pq_cache, GFP_KERNEL);
+    if (pq == NULL) {
+        printk(KERN_ALERT "Error: could not allocate memory for priority queue\n");
+        return NULL;
     }
-    min_elem->val = pq->heap[0].val;
-    min_elem->priority = pq->heap[0].priority;
-    min_elem->insert_time = pq->heap[0].insert_time;
-
-    pq->heap[0] = pq->heap[pq->size - 1];
-    pq->size--;
-    shift_down(pq, 0);
-    return 0;
+    init_pq(pq);
+    return pq;
 }
 
-static int extract_max(struct priority_queue *pq, struct element *max_elem) {
-    struct element max_el, temp;
-    int max_ind, i;
+// Maximum number of elements the queue may hold
+static int pq_limit(struct priority_queue *pq) {
+    return pq_capacity_limit(pq->capacity);
+}
 
-    if (pq->size == 0) {
-        printk(KERN_ALERT "Error: priority queue is empty\n");
-        return -EACCES;
-    }
-    max_ind = 0;
-    max_el = pq->heap[0];
-    for (i = 1; i < pq->size; i++) {
-        if (compare(&max_el, &pq->heap[i])) {
-            max_el = pq->heap[i];
-            max_ind = i;
-        }
-    }
-    max_elem->val = max_el.val;
-    max_elem->priority = max_el.priority;
-    max_elem->insert_time = max_el.insert_time;
+static int pq_full(struct priority_queue *pq) {
+    return atomic_read(&pq->count) >= pq_limit(pq);
+}
 
-    pq->heap[max_ind].priority = -1;
-    shift_up(pq, max_ind);
-    extract_min(pq, &temp);
-    return 0;
+// Largest priority accepted by the queue
+static int pq_max_priority(struct priority_queue *pq) {
+    return pq->backend == PB2_BACKEND_BUCKET ? PQ_BUCKET_PRIOS : INT_MAX;
 }
 
-// Print priority queue
-static void print_pq(struct priority_queue *pq) {
-#ifdef DEBUG
-    printk(KERN_INFO "Priority queue for process %d:\n", current->pid);
-    if (pq != NULL && pq->heap != NULL) {
-        int i;
-        for (i = 0; i < pq->size; i++) {
-            printk(KERN_INFO "%d  [%d, %d, %d]\n", i, pq->heap[i].val, pq->heap[i].priority, pq->heap[i].insert_time);
-        }
-    }
-    printk("\n");
-#endif
+// Number of elements in the queue as seen by the lock holder
+static int pq_size(struct priority_queue *pq) {
+    return pq->subs != NULL ? atomic_read(&pq->count) : pq->size;
 }
 
-// Free the memory allocated to the priority queue
-static void delete_pq(struct priority_queue *pq) {
-    if (pq != NULL) {
-        kfree(pq->heap);
-        kfree(pq);
+// Number of elements the heap arrays can hold, racy for relaxed queues
+static long pq_allocated(struct priority_queue *pq) {
+    long alloc = pq->alloc;
+    int i;
+    for (i = 0; i < pq->nr_subs; i++) {
+        alloc += READ_ONCE(pq->subs[i].alloc);
     }
+    return alloc;
 }
 
-// Find the process node with the given pid
-static struct process_node *find_process(pid_t pid) {
-    struct process_node *curr = process_list;
-    while (curr != NULL) {
-        if (curr->pid == pid) {
-            return curr;
-        }
-        curr = curr->next;
+// Bytes allocated for the elements, nodes and handles of the queue and its sub-heaps, as
+// counted in STAT_MEMORY, racy like pq_allocated()
+static long pq_memory(struct priority_queue *pq) {
+    long memory = READ_ONCE(pq->memory);
+    int i;
+    for (i = 0; i < pq->nr_subs; i++) {
+        memory += READ_ONCE(pq->subs[i].memory);
     }
-    return NULL;
+    return memory;
 }
 
-// Insert a process node with the given pid
-static struct process_node *insert_process(pid_t pid) {
-    struct process_node *node = kmalloc(sizeof(struct process_node), GFP_KERNEL);
-    if (node == NULL) {
-        return NULL;
-    }
-    node->pid = pid;
-    node->state = PROC_FILE_OPEN;
-    node->proc_pq = NULL;
-    node->next = process_list;
-    process_list = node;
-    return node;
+// Bytes used by the queue structures, heap storage and handles
+static long pq_footprint(struct priority_queue *pq) {
+    return (1 + pq->nr_subs) * sizeof(struct priority_queue) + pq_memory(pq);
 }
 
-// Free the memory allocated to a process node
-static void delete_process_node(struct process_node *node) {
-    if (node != NULL) {
-        delete_pq(node->proc_pq);
-        kfree(node);
-    }
+// Account n more bytes allocated for pq, or fewer if n is negative, called with its lock held
+static void mem_add(struct priority_queue *pq, s64 n) {
+    WRITE_ONCE(pq->memory, pq->memory + n);
+    stat_add(NULL, STAT_MEMORY, n);
 }
 
-// Delete a process node with the given pid
-static int delete_process(pid_t pid) {
-    struct process_node *prev = NULL;
-    struct process_node *curr = process_list;
-    while (curr != NULL) {
-        if (curr->pid == pid) {
-            if (prev == NULL) {
-                process_list = curr->next;
-            } else {
-                prev->next = curr->next;
-            }
-            delete_process_node(curr);
+// Reserve up to n free slots, returns the number reserved. Safe without the lock.
+static int reserve_slots(struct priority_queue *pq, int n) {
+    int count = atomic_read(&pq->count);
+    int avail;
+
+    do {
+        avail = min(n, pq_limit(pq) - count);
+        if (avail <= 0) {
             return 0;
         }
-        prev = curr;
-        curr = curr->next;
+    } while (!atomic_try_cmpxchg(&pq->count, &count, count + avail));
+    stat_max(&global_stats, STAT_PEAK, count + avail);
+    if (pq->stats != NULL) {
+        stat_max(pq->stats, STAT_PEAK, count + avail);
     }
-    return -EACCES;
+    return avail;
 }
 
-// Free the memory allocated to all process nodes
-static void delete_process_list(void) {
-    struct process_node *curr = process_list;
-    while (curr != NULL) {
-        struct process_node *temp = curr;
-        curr = curr->next;
-        delete_process_node(temp);
+// Give back n slots, reserved for elements that were never inserted or freed by
+// extractions. Producers sleeping in wait_space() get them first, one each in the order
+// they queued, so that a newcomer cannot take them. Only the rest returns to the queue.
+static void release_slots(struct priority_queue *pq, int n) {
+    struct space_grant grant = {n};
+
+    if (n > 0 && READ_ONCE(pq->space_waiters) > 0) {
+        __wake_up(&pq->writeq, TASK_INTERRUPTIBLE, n, &grant);
+    }
+    if (grant.left > 0) {
+        atomic_sub(grant.left, &pq->count);
+        // Wakes pollers, and a producer that queued after the grants were handed out
+        wake_up_interruptible_nr(&pq->writeq, grant.left);
     }
 }
 
-// Open, close handlers for proc file
+// Heap arrays of up to 1 << POOL_MAX_ORDER bytes are rounded up to a power of two and
+// recycled through a few arrays kept per size, so that queues reset or opened and closed
+// in quick succession reuse memory instead of going back to the page allocator
 
-// Open handler for proc file
-static int procfile_open(struct inode *inode, struct file *file) {
-    pid_t pid;
-    int ret;
-    struct process_node *curr;
+static int pool_class(size_t bytes) {
+    return max(order_base_2(bytes), POOL_MIN_ORDER) - POOL_MIN_ORDER;
+}
 
-    mutex_lock(&mutex);
+// Bytes actually taken by an array from pool_alloc()
+static size_t pool_size(size_t bytes) {
+    return bytes > (1UL << POOL_MAX_ORDER) ? bytes : (size_t)1 << (pool_class(bytes) + POOL_MIN_ORDER);
+}
 
-    pid = current->pid;
-    printk(KERN_INFO "procfile_open() invoked by process %d\n", pid);
-    ret = 0;
+static void *pool_alloc(struct priority_queue *pq, size_t bytes) {
+    void *mem = NULL;
+    int c;
 
-    curr = find_process(pid);
-    if (curr == NULL) {
-        curr = insert_process(pid);
-        if (curr == NULL) {
-            printk(KERN_ALERT "Error: could not allocate memory for process node\n");
-            ret = -ENOMEM;
-        } else {
-            printk(KERN_INFO "Process %d has been added to the process list\n", pid);
-        }
+    if (bytes > (1UL << POOL_MAX_ORDER)) {
+        mem = kvmalloc(bytes, GFP_KERNEL);
     } else {
-        printk(KERN_ALERT "Error: process %d has the proc file already open\n", pid);
-        ret = -EACCES;
+        c = pool_class(bytes);
+        spin_lock(&pool_lock);
+        if (pool_count[c] > 0) {
+            mem = pool[c][--pool_count[c]];
+        }
+        spin_unlock(&pool_lock);
+        if (mem == NULL) {
+            mem = kvmalloc(pool_size(bytes), GFP_KERNEL);
+        }
     }
-
-    mutex_unlock(&mutex);
-    return ret;
+    if (mem != NULL) {
+        mem_add(pq, pool_size(bytes));
+    }
+    return mem;
 }
 
-// Close handler for proc file
-static int procfile_close(struct inode *inode, struct file *file) {
-    pid_t pid;
-    int ret;
-    struct process_node *curr;
+// Give back an array from pool_alloc() of the same number of bytes
+static void pool_free(struct priority_queue *pq, void *mem, size_t bytes) {
+    int c;
 
-    mutex_lock(&mutex);
+    if (mem != NULL) {
+        mem_add(pq, -(s64)pool_size(bytes));
+    }
+    if (mem != NULL && bytes <= (1UL << POOL_MAX_ORDER)) {
+        c = pool_class(bytes);
+        spin_lock(&pool_lock);
+        if (pool_count[c] < POOL_DEPTH) {
+            pool[c][pool_count[c]++] = mem;
+            mem = NULL;
+        }
+        spin_unlock(&pool_lock);
+    }
+    kvfree(mem);
+}
 
-    pid = current->pid;
-    printk(KERN_INFO "procfile_close() invoked by process %d\n", pid);
-    ret = 0;
+static void pool_drain(void) {
+    int c;
+    for (c = 0; c <= POOL_MAX_ORDER - POOL_MIN_ORDER; c++) {
+        while (pool_count[c] > 0) {
+            kvfree(pool[c][--pool_count[c]]);
+        }
+    }
+}
 
-    curr = find_process(pid);
-    if (curr == NULL) {
-        printk(KERN_ALERT "Error: process %d does not have the proc file open\n", pid);
-        ret = -EACCES;
-    } else {
-        delete_process(pid);
-        printk(KERN_INFO "Process %d has been removed from the process list\n", pid);
+// Bytes of the heap storage for alloc elements of an array backend, see dary_resize()
+static size_t heap_bytes(int backend, int alloc) {
+    if (backend == PB2_BACKEND_DARY) {
+        return (alloc + 2 * DARY_ARITY) * sizeof(u64) + alloc * sizeof(int);
     }
+    return alloc * sizeof(struct element);
+}
 
-    mutex_unlock(&mutex);
-    return ret;
+// First of n consecutive insert times of the queue
+static int take_times(struct priority_queue *pq, int n) {
+    return atomic_fetch_add(n, &pq->timer);
 }
 
-static long pb2_set_capacity(unsigned long arg, struct process_node *curr) {
-    int32_t capacity;
+// Keys are stored from keys[-DARY_PAD] on an aligned boundary, so the children
+// DARY_ARITY * i + 1 ... DARY_ARITY * i + DARY_ARITY of every node share a cache line
+static int dary_resize(struct priority_queue *pq, int alloc) {
+    size_t key_bytes = (alloc + 2 * DARY_ARITY) * sizeof(u64);
+    void *mem = pool_alloc(pq, heap_bytes(PB2_BACKEND_DARY, alloc));
+    u64 *keys;
+    int *vals;
 
-    printk(KERN_INFO "PB2_SET_CAPACITY invoked by process %d\n", curr->pid);
-    if (copy_from_user(&capacity, (int32_t *)arg, sizeof(int32_t)) != 0) {
-        printk(KERN_ALERT "Error: could not copy capacity from user\n");
-        return -EINVAL;
-    }
-    if (curr->state != PROC_FILE_OPEN) {
-        delete_pq(curr->proc_pq);
-        printk(KERN_INFO "Resetting priority queue for process %d\n", curr->pid);
-    }
-    if (capacity < 1 || capacity > 100) {
-        printk(KERN_ALERT "Error: Capacity must be between 1 and 100\n");
-        return -EINVAL;
-    }
-    curr->proc_pq = create_pq(capacity);
-    if (curr->proc_pq == NULL) {
-        printk(KERN_ALERT "Error: priority queue initialization failed\n");
+    if (mem == NULL) {
         return -ENOMEM;
     }
-    printk(KERN_INFO "Priority queue with capacity %d has been intialized for process %d\n", capacity, curr->pid);
-    curr->state = PROC_READ_VALUE;
+    keys = PTR_ALIGN((u64 *)mem, DARY_ARITY * sizeof(u64)) + DARY_PAD;
+    vals = mem + key_bytes;
+    if (pq->size > 0) {
+        memcpy(keys, pq->keys, pq->size * sizeof(u64));
+        memcpy(vals, pq->vals, pq->size * sizeof(int));
+    }
+    pool_free(pq, pq->dary, heap_bytes(PB2_BACKEND_DARY, pq->alloc));
+    pq->dary = mem;
+    pq->keys = keys;
+    pq->vals = vals;
+    pq->alloc = alloc;
     return 0;
 }
 
-static long pb2_insert_int(unsigned long arg, struct process_node *curr) {
-    int32_t value;
+// Grow or shrink the spare nodes of a pairing heap so that alloc elements fit. Nodes
+// are allocated one at a time, on failure the queue keeps the ones it already got.
+static int pairing_resize(struct priority_queue *pq, int alloc) {
+    struct pq_node *node;
 
-    printk(KERN_INFO "PB2_INSERT_INT invoked by process %d\n", curr->pid);
-    if (copy_from_user(&value, (int32_t *)arg, sizeof(int32_t)) != 0) {
-        printk(KERN_ALERT "Error: could not copy value from user\n");
-        return -EINVAL;
+    while (pq->alloc < alloc) {
+        node = kmem_cache_alloc(pq_node_cache, GFP_KERNEL);
+        if (node == NULL) {
+            return -ENOMEM;
+        }
+        node->next = pq->spare;
+        pq->spare = node;
+        pq->alloc++;
+        mem_add(pq, sizeof(struct pq_node));
     }
-    if (curr->state == PROC_READ_VALUE) {
-        curr->proc_pq->last_value = value;
-        printk(KERN_INFO "Value %d has been written to the proc file for process %d\n", value, curr->pid);
-        curr->state = PROC_READ_PRIORITY;
-    } else if (curr->state == PROC_FILE_OPEN) {
-        printk(KERN_ALERT "Error: process %d has not set the capacity of the priority queue\n", curr->pid);
-        return -EACCES;
-    } else if (curr->state == PROC_READ_PRIORITY) {
-        printk(KERN_ALERT "Error: process %d is supposed to enter a value, not priority\n", curr->pid);
-        return -EACCES;
+    while (pq->alloc > alloc && pq->spare != NULL) {
+        node = pq->spare;
+        pq->spare = node->next;
+        kmem_cache_free(pq_node_cache, node);
+        pq->alloc--;
+        mem_add(pq, -(s64)sizeof(struct pq_node));
     }
     return 0;
 }
 
-static long pb2_insert_prio(unsigned long arg, struct process_node *curr) {
-    int32_t prio;
+// Free the nodes of a pairing heap and its spare nodes
+static void pairing_free(struct priority_queue *pq) {
+    struct pq_node *list = pq->root, *node, *last;
+    int freed = 0;
 
-    printk(KERN_INFO "PB2_INSERT_PRIO invoked by process %d\n", curr->pid);
-    if (copy_from_user(&prio, (int32_t *)arg, sizeof(int32_t)) != 0) {
-        printk(KERN_ALERT "Error: could not copy priority from user\n");
-        return -EINVAL;
-    }
-    if (curr->state == PROC_READ_PRIORITY) {
-        if (curr->proc_pq->size == curr->proc_pq->capacity) {
-            printk(KERN_ALERT "Error: priority queue is full\n");
-            return -EACCES;
+    // Walk the tree as a list, splicing in the children of each node before freeing it
+    while (list != NULL) {
+        node = list;
+        list = node->next;
+        if (node->child != NULL) {
+            last = node->child;
+            while (last->next != NULL) {
+                last = last->next;
+            }
+            last->next = list;
+            list = node->child;
         }
-        if (prio < 1) {
-            printk(KERN_ALERT "Error: Priority must be a positive integer\n");
-            return -EINVAL;
+        kmem_cache_free(pq_node_cache, node);
+        freed++;
+    }
+    while (pq->spare != NULL) {
+        node = pq->spare;
+        pq->spare = node->next;
+        kmem_cache_free(pq_node_cache, node);
+        freed++;
+    }
+    pq->root = NULL;
+    mem_add(pq, -(s64)freed * sizeof(struct pq_node));
+}
+
+// Allocate the FIFO heads of a bucket queue if it has none, then grow or shrink its spare nodes like pairing_resize()
+static int bucket_resize(struct priority_queue *pq, int alloc) {
+    if (pq->buckets == NULL) {
+        pq->buckets = kvzalloc(sizeof(struct pq_buckets), GFP_KERNEL);
+        if (pq->buckets == NULL) {
+            return -ENOMEM;
         }
-        printk(KERN_INFO "Priority %d has been written to the proc file for process %d\n", prio, curr->pid);
-        insert(curr->proc_pq, curr->proc_pq->last_value, prio);
-        printk(KERN_INFO "(%d, %d) value-priority element has been inserted into the priority queue for process %d\n", curr->proc_pq->last_value, prio, curr->pid);
-        curr->state = PROC_READ_VALUE;
-    } else if (curr->state == PROC_FILE_OPEN) {
-        printk(KERN_ALERT "Error: process %d has not set the capacity of the priority queue\n", curr->pid);
-        return -EACCES;
-    } else if (curr->state == PROC_READ_VALUE) {
-        printk(KERN_ALERT "Error: process %d is supposed to enter priority, not value\n", curr->pid);
-        return -EACCES;
+        mem_add(pq, sizeof(struct pq_buckets));
     }
-    return 0;
+    return pairing_resize(pq, alloc);
 }
 
-static long pb2_get_info(unsigned long arg, struct process_node *curr) {
-    struct obj_info info;
-    printk(KERN_INFO "PB2_GET_INFO invoked by process %d\n", curr->pid);
-    if (curr->state == PROC_FILE_OPEN) {
-        printk(KERN_ALERT "Error: process %d has not set the capacity of the priority queue\n", curr->pid);
-        return -EACCES;
+// Put the nodes of a bucket queue on its spare nodes and free its FIFO heads
+static void bucket_free(struct priority_queue *pq) {
+    struct pq_node *head;
+    int b;
+
+    if (pq->buckets == NULL) {
+        return;
     }
-    info.prio_que_size = curr->proc_pq->size;
-    info.capacity = curr->proc_pq->capacity;
-    if (copy_to_user((struct obj_info *)arg, &info, sizeof(struct obj_info))) {
-        printk(KERN_ALERT "Error: could not copy info to user\n");
-        return -EINVAL;
+    for_each_set_bit(b, pq->buckets->map, PQ_BUCKET_PRIOS) {
+        // Cut the circle before the oldest node and chain the FIFO in front of the spare nodes
+        head = pq->buckets->head[b];
+        head->prev->next = pq->spare;
+        pq->spare = head;
     }
-    return 0;
+    kvfree(pq->buckets);
+    mem_add(pq, -(s64)sizeof(struct pq_buckets));
+    pq->buckets = NULL;
 }
 
-static long pb2_get_min(unsigned long arg, struct process_node *curr) {
-    int min_val;
-    struct element min_elem;
-    printk(KERN_INFO "PB2_GET_MIN invoked by process %d\n", curr->pid);
-    if (curr->state == PROC_FILE_OPEN) {
-        printk(KERN_ALERT "Error: process %d has not yet written anything to the proc file\n", curr->pid);
-        return -EACCES;
+// Free the storage of any backend
+static void free_heap(struct priority_queue *pq) {
+    bucket_free(pq);
+    pairing_free(pq);
+    pool_free(pq, pq->heap, heap_bytes(PB2_BACKEND_MINMAX, pq->alloc));
+    pool_free(pq, pq->dary, heap_bytes(PB2_BACKEND_DARY, pq->alloc));
+    pq->heap = NULL;
+    pq->dary = NULL;
+    pq->keys = NULL;
+    pq->vals = NULL;
+    pq->alloc = 0;
+}
+
+// Move the heap to a new array of alloc elements, kvmalloc() avoids high-order pages for big heaps
+static int resize_heap(struct priority_queue *pq, int alloc) {
+    struct element *heap;
+
+    if (pq->backend == PB2_BACKEND_DARY) {
+        return dary_resize(pq, alloc);
+    } else if (pq->backend == PB2_BACKEND_PAIRING) {
+        return pairing_resize(pq, alloc);
+    } else if (pq->backend == PB2_BACKEND_BUCKET) {
+        return bucket_resize(pq, alloc);
     }
-    // curr->proc_pq cannot be NULL if the control comes here
-    if (curr->proc_pq->size == 0) {
-        printk(KERN_ALERT "Error: priority queue is empty\n");
-        return -EACCES;
+    heap = pool_alloc(pq, heap_bytes(PB2_BACKEND_MINMAX, alloc));
+    if (heap == NULL) {
+        return -ENOMEM;
     }
-    extract_min(curr->proc_pq, &min_elem);
-    min_val = min_elem.val;
-    if (copy_to_user((int32_t *)arg, &min_val, sizeof(int32_t))) {
-        printk(KERN_ALERT "Error: could not copy min value to user\n");
-        return -EINVAL;
+    if (pq->size > 0) {
+        memcpy(heap, pq->heap, pq->size * sizeof(struct element));
     }
+    pool_free(pq, pq->heap, heap_bytes(PB2_BACKEND_MINMAX, pq->alloc));
+    pq->heap = heap;
+    pq->alloc = alloc;
     return 0;
 }
 
-static long pb2_get_max(unsigned long arg, struct process_node *curr) {
-    int max_val;
-    struct element max_elem;
-    printk(KERN_INFO "PB2_GET_MAX invoked by process %d\n", curr->pid);
-    if (curr->state == PROC_FILE_OPEN) {
-        printk(KERN_ALERT "Error: process %d has not yet written anything to the proc file\n", curr->pid);
-        return -EACCES;
+// Make room for n elements, growing the heap array geometrically
+static int reserve_pq(struct priority_queue *pq, int n) {
+    int alloc;
+    if (n <= pq->alloc) {
+        return 0;
     }
-    // curr->proc_pq cannot be NULL if the control comes here
-    if (curr->proc_pq->size == 0) {
-        printk(KERN_ALERT "Error: priority queue is empty\n");
-        return -EACCES;
+    // Nodes are allocated one by one, doubling would only pile up spare nodes
+    if (pq->backend == PB2_BACKEND_PAIRING || pq->backend == PB2_BACKEND_BUCKET) {
+        alloc = min(n, pq_limit(pq));
+    } else {
+        alloc = pq_grow_alloc(pq->alloc, n, pq_limit(pq));
     }
-    extract_max(curr->proc_pq, &max_elem);
-    max_val = max_elem.val;
-    if (copy_to_user((int32_t *)arg, &max_val, sizeof(int32_t))) {
-        printk(KERN_ALERT "Error: could not copy max value to user\n");
-        return -EINVAL;
+    if (resize_heap(pq, alloc) < 0) {
+        printk(KERN_ALERT "Error: could not allocate memory for priority queue heap array\n");
+        return -ENOMEM;
     }
     return 0;
 }
 
-static long proc_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
-    int ret;
-    pid_t pid;
-    struct process_node *curr;
-
-    mutex_lock(&mutex);
+// Halve the heap array once the queue has drained to a quarter of it
+static void shrink_pq(struct priority_queue *pq) {
+    int alloc = pq_shrink_alloc(pq->alloc, pq->size);
+    if (alloc < pq->alloc) {
+        // On failure the queue simply keeps the larger array
+        resize_heap(pq, alloc);
+    }
+}
+
+// Take an unused handle, growing the table geometrically. Returns its index or -ENOMEM.
+static int alloc_handle(struct priority_queue *pq) {
+    struct pq_handle *handles;
+    int i, n, h;
+
+    if (pq->free_handle < 0) {
+        n = max(2 * pq->nr_handles, PQ_MIN_ALLOC);
+        handles = kvmalloc_array(n, sizeof(struct pq_handle), GFP_KERNEL);
+        if (handles == NULL) {
+            printk(KERN_ALERT "Error: could not allocate memory for handles\n");
+            return -ENOMEM;
+        }
+        if (pq->nr_handles > 0) {
+            memcpy(handles, pq->handles, pq->nr_handles * sizeof(struct pq_handle));
+        }
+        for (i = pq->nr_handles; i < n; i++) {
+            handles[i].pos = i + 1 < n ? -2 - (i + 1) : -1;
+            handles[i].gen = 0;
+        }
+        kvfree(pq->handles);
+        mem_add(pq, (s64)(n - pq->nr_handles) * sizeof(struct pq_handle));
+        pq->free_handle = pq->nr_handles;
+        pq->handles = handles;
+        pq->nr_handles = n;
+    }
+    h = pq->free_handle;
+    pq->free_handle = -2 - pq->handles[h].pos;
+    return h;
+}
+
+static void release_handle(struct priority_queue *pq, int h) {
+    pq->handles[h].gen++;
+    pq->handles[h].pos = -2 - pq->free_handle;
+    pq->free_handle = h;
+}
+
+// Release every handle of a queue being emptied. The table is kept, so generations keep
+// counting and handles returned before the reset cannot match the elements inserted after it.
+static void release_handles(struct priority_queue *pq) {
+    int i;
+
+    pq->free_handle = -1;
+    for (i = pq->nr_handles - 1; i >= 0; i--) {
+        if (pq->handles[i].pos >= 0) {
+            pq->handles[i].gen++;
+        }
+        pq->handles[i].pos = -2 - pq->free_handle;
+        pq->free_handle = i;
+    }
+}
+
+static void free_handles(struct priority_queue *pq) {
+    kvfree(pq->handles);
+    mem_add(pq, -(s64)pq->nr_handles * sizeof(struct pq_handle));
+    pq->handles = NULL;
+    pq->nr_handles = 0;
+    pq->free_handle = -1;
+}
+
+// Heap index of the element of a user handle, which is (generation << 32 | index), or -ENOENT
+static int lookup_handle(struct priority_queue *pq, int64_t handle) {
+    u32 h = (u32)handle;
+    if (h >= pq->nr_handles || pq->handles[h].gen != (u32)(handle >> 32) || pq->handles[h].pos < 0) {
+        return -ENOENT;
+    }
+    return pq->handles[h].pos;
+}
+
+// (Re)initialize the priority queue with the given capacity, dropping all its elements
+static int reset_pq(struct priority_queue *pq, int capacity) {
+    int alloc;
+
+    pq->capacity = capacity;
+    alloc = min(pq_limit(pq), PQ_MIN_ALLOC);
+    // An array that already has the initial size is simply reused, e.g. when the capacity is set again
+    if (pq->backend == PB2_BACKEND_PAIRING || pq->backend == PB2_BACKEND_BUCKET || pq->alloc != alloc) {
+        free_heap(pq);
+    }
+    release_handles(pq);
+    // Slots reserved by inserts still on their way to staged stay counted, see pb2_insert_staged()
+    atomic_sub(pq->size, &pq->count);
+    pq->size = 0;
+    atomic_set(&pq->timer, 0);
+    if (reserve_pq(pq, alloc) < 0) {
+        pq->capacity = 0;
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+// The PB2_BACKEND_DARY heap is a 4-ary min-heap kept as two arrays: keys[] holds
+// pack_key() of every element and vals[] its value. Ordering is one unsigned compare
+// of the keys and the children of a node are one cache line, so a level costs one
+// miss instead of one per binary level. It has no fast path to the maximum, which
+// PB2_GET_MAX finds by scanning the leaves.
+
+// Fill the hole at index i with (key, val), moving it up past larger parents
+static void dary_shift_up(struct priority_queue *pq, int i, u64 key, int val) {
+    int parent;
+    while (i > 0) {
+        parent = (i - 1) / DARY_ARITY;
+        if (pq->keys[parent] <= key) {
+            break;
+        }
+        pq->keys[i] = pq->keys[parent];
+        pq->vals[i] = pq->vals[parent];
+        i = parent;
+    }
+    pq->keys[i] = key;
+    pq->vals[i] = val;
+}
+
+// Fill the hole at index i with (key, val), moving it down past smaller children
+static void dary_shift_down(struct priority_queue *pq, int i, u64 key, int val) {
+    int child, last, best, j;
+    while ((child = DARY_ARITY * i + 1) < pq->size) {
+        last = min(child + DARY_ARITY, pq->size);
+        best = child;
+        for (j = child + 1; j < last; j++) {
+            best = pq->keys[j] < pq->keys[best] ? j : best;
+        }
+        if (pq->keys[best] >= key) {
+            break;
+        }
+        pq->keys[i] = pq->keys[best];
+        pq->vals[i] = pq->vals[best];
+        i = best;
+    }
+    pq->keys[i] = key;
+    pq->vals[i] = val;
+}
+
+// Index of the maximum, which is one of the leaves
+static int dary_max_index(struct priority_queue *pq) {
+    int i, best = pq->size == 1 ? 0 : (pq->size - 2) / DARY_ARITY + 1;
+    for (i = best + 1; i < pq->size; i++) {
+        best = pq->keys[i] > pq->keys[best] ? i : best;
+    }
+    return best;
+}
+
+// Remove the element at index i into elem, the last element takes its place
+static void dary_remove(struct priority_queue *pq, int i, struct element *elem) {
+    u64 key = pq->keys[i];
+
+    elem->val = pq->vals[i];
+    elem->priority = key >> 32;
+    elem->insert_time = (u32)key;
+    stat_add(pq, STAT_EXTRACTS, 1);
+    pq->size--;
+    atomic_dec(&pq->count);
+    if (i < pq->size) {
+        key = pq->keys[pq->size];
+        // A leaf replaced by the last element, as when removing the maximum, may need to move up
+        if (i > 0 && key < pq->keys[(i - 1) / DARY_ARITY]) {
+            dary_shift_up(pq, i, key, pq->vals[pq->size]);
+        } else {
+            dary_shift_down(pq, i, key, pq->vals[pq->size]);
+        }
+    }
+    shrink_pq(pq);
+}
+
+// The PB2_BACKEND_PAIRING heap is a pairing heap: a tree of nodes in which every node
+// precedes its children, with the minimum at the root. Inserting and melding link two
+// roots in O(1), extracting the minimum pairs up the children of the root in two passes
+// for O(log n) amortized. Nodes hold their element, so melding two queues moves no
+// elements. The insert times of a melded tree are shifted in O(1) as well: the shift is
+// put on its root and handed down lazily, so only roots have exact insert times and the
+// time of any other node is off by the shifts of its ancestors. Like the d-ary heap it
+// has no fast path to the maximum.
+
+// Make the later of two roots the first child of the other, returns the new root
+static struct pq_node *pairing_link(struct pq_node *a, struct pq_node *b) {
+    if (a == NULL || (b != NULL && compare(&b->elem, &a->elem))) {
+        swap(a, b);
+    }
+    if (a == NULL) {
+        return NULL;
+    }
+    a->next = NULL;
+    a->prev = NULL;
+    if (b != NULL) {
+        // The shift of a now also applies to b and its descendants, which already have theirs
+        b->elem.insert_time -= a->shift;
+        b->shift -= a->shift;
+        b->prev = a;
+        b->next = a->child;
+        if (a->child != NULL) {
+            a->child->prev = b;
+        }
+        a->child = b;
+    }
+    return a;
+}
+
+// Link a list of siblings into one tree: pairs from left to right, then the pairs from right to left
+static struct pq_node *pairing_merge_pairs(struct pq_node *first) {
+    struct pq_node *pairs = NULL, *root = NULL, *a, *b;
+
+    while (first != NULL) {
+        a = first;
+        b = a->next;
+        first = b != NULL ? b->next : NULL;
+        a = pairing_link(a, b);
+        a->next = pairs;
+        pairs = a;
+    }
+    while (pairs != NULL) {
+        a = pairs;
+        pairs = a->next;
+        root = pairing_link(root, a);
+    }
+    return root;
+}
+
+// Successor of node in a preorder walk of its tree, NULL after the last node. *shift is the
+// sum of the shifts of the ancestors of node, 0 for the root, and is updated to the successor's.
+static struct pq_node *pairing_next(struct pq_node *node, int *shift) {
+    if (node->child != NULL) {
+        *shift += node->shift;
+        return node->child;
+    }
+    while (node->next == NULL) {
+        // Back to the first sibling, whose prev is the parent
+        while (node->prev != NULL && node->prev->child != node) {
+            node = node->prev;
+        }
+        node = node->prev;
+        if (node == NULL) {
+            return NULL;
+        }
+        *shift -= node->shift;
+    }
+    return node->next;
+}
+
+// Node of the maximum element, found by walking the whole tree, and the sum of the shifts of its ancestors
+static struct pq_node *pairing_max(struct priority_queue *pq, int *shift) {
+    struct pq_node *node = pq->root, *best = pq->root;
+    struct element elem, best_elem = pq->root->elem;
+    int at = 0;
+
+    *shift = 0;
+    while ((node = pairing_next(node, &at)) != NULL) {
+        elem = node->elem;
+        elem.insert_time += at;
+        if (compare(&best_elem, &elem)) {
+            best = node;
+            best_elem = elem;
+            *shift = at;
+        }
+    }
+    return best;
+}
+
+// Add an element on one of the spare nodes
+static void pairing_push(struct priority_queue *pq, int val, int priority, int insert_time) {
+    struct pq_node *node = pq->spare;
+
+    pq->spare = node->next;
+    node->elem.val = val;
+    node->elem.priority = priority;
+    node->elem.insert_time = insert_time;
+    node->elem.handle = -1;
+    node->child = NULL;
+    node->shift = 0;
+    pq->root = pairing_link(pq->root, node);
+    pq->size++;
+}
+
+// Remove the element of node into elem, shift being the sum of the shifts of its ancestors.
+// The node becomes a spare.
+static void pairing_remove(struct priority_queue *pq, struct pq_node *node, int shift, struct element *elem) {
+    struct pq_node *child;
+
+    stat_add(pq, STAT_EXTRACTS, 1);
+    *elem = node->elem;
+    elem->insert_time += shift;
+    // The children become roots, which have exact insert times
+    shift += node->shift;
+    for (child = node->child; child != NULL; child = child->next) {
+        child->elem.insert_time += shift;
+        child->shift += shift;
+    }
+    if (node == pq->root) {
+        pq->root = pairing_merge_pairs(node->child);
+    } else {
+        // Cut the subtree of node out of its sibling list and link its children back in
+        if (node->prev->child == node) {
+            node->prev->child = node->next;
+        } else {
+            node->prev->next = node->next;
+        }
+        if (node->next != NULL) {
+            node->next->prev = node->prev;
+        }
+        pq->root = pairing_link(pq->root, pairing_merge_pairs(node->child));
+    }
+    node->next = pq->spare;
+    pq->spare = node;
+    pq->size--;
+    atomic_dec(&pq->count);
+    shrink_pq(pq);
+}
+
+// The PB2_BACKEND_BUCKET queue is a bucket queue for priorities 1 .. PQ_BUCKET_PRIOS:
+// one circular FIFO of nodes per priority, oldest first, and a bitmap of the priorities
+// that have elements. Inserting appends to a FIFO in O(1) and extracting takes the
+// oldest node of the first set bit, or the newest of the last one, so no element is
+// ever compared. Ties leave in insert time order like with the heaps.
+
+// Add an element on one of the spare nodes, behind the elements of its priority inserted before it
+static void bucket_push(struct priority_queue *pq, int val, int priority, int insert_time) {
+    struct pq_node *node = pq->spare, **head = &pq->buckets->head[priority - 1], *pos;
+
+    pq->spare = node->next;
+    node->elem.val = val;
+    node->elem.priority = priority;
+    node->elem.insert_time = insert_time;
+    node->elem.handle = -1;
+    if (*head == NULL) {
+        node->next = node;
+        node->prev = node;
+        *head = node;
+        __set_bit(priority - 1, pq->buckets->map);
+    } else {
+        // Usually the newest, but a staged chunk merged late comes after elements inserted
+        // under the lock meanwhile, walk back past those
+        pos = (*head)->prev;
+        while (pos != *head && pos->elem.insert_time > insert_time) {
+            pos = pos->prev;
+        }
+        if (pos->elem.insert_time > insert_time) {
+            // Older than every element of its priority, pos is the oldest
+            *head = node;
+            pos = pos->prev;
+        }
+        node->prev = pos;
+        node->next = pos->next;
+        pos->next->prev = node;
+        pos->next = node;
+    }
+    pq->size++;
+}
+
+// Remove the minimum element, or the maximum if largest is set, into elem, the node becomes a spare
+static void bucket_remove(struct priority_queue *pq, int largest, struct element *elem) {
+    int b = largest ? find_last_bit(pq->buckets->map, PQ_BUCKET_PRIOS) : find_first_bit(pq->buckets->map, PQ_BUCKET_PRIOS);
+    struct pq_node **head = &pq->buckets->head[b];
+    struct pq_node *node = largest ? (*head)->prev : *head;
+
+    stat_add(pq, STAT_EXTRACTS, 1);
+    *elem = node->elem;
+    if (node->next == node) {
+        *head = NULL;
+        __clear_bit(b, pq->buckets->map);
+    } else {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        if (*head == node) {
+            *head = node->next;
+        }
+    }
+    node->next = pq->spare;
+    pq->spare = node;
+    pq->size--;
+    atomic_dec(&pq->count);
+    shrink_pq(pq);
+}
+
+// Restore the heap order of elements stored in any order, in O(n) like minmax_heapify()
+static void heapify(struct priority_queue *pq) {
+    int i;
+
+    if (pq->size < 2) {
+        return;
+    }
+    if (pq->backend == PB2_BACKEND_DARY) {
+        for (i = (pq->size - 2) / DARY_ARITY; i >= 0; i--) {
+            dary_shift_down(pq, i, pq->keys[i], pq->vals[i]);
+        }
+    } else {
+        minmax_heapify(pq->heap, pq->size, pq->handles);
+    }
+}
+
+// Add an element whose slot has been reserved to a heap array with room for it.
+// handle is an entry of pq->handles for the min-max heap, or -1.
+static void heap_push(struct priority_queue *pq, int val, int priority, int insert_time, int handle) {
+    struct element elem = {val, priority, insert_time, handle};
+
+    stat_add(pq, STAT_INSERTS, 1);
+    if (pq->backend == PB2_BACKEND_DARY) {
+        dary_shift_up(pq, pq->size, pack_key(priority, insert_time), val);
+        pq->size++;
+        return;
+    } else if (pq->backend == PB2_BACKEND_PAIRING) {
+        pairing_push(pq, val, priority, insert_time);
+        return;
+    } else if (pq->backend == PB2_BACKEND_BUCKET) {
+        bucket_push(pq, val, priority, insert_time);
+        return;
+    }
+    minmax_push(pq->heap, pq->size, pq->handles, &elem);
+    pq->size++;
+}
+
+// Remove the element at index i by moving the last element into its place
+static void remove_at(struct priority_queue *pq, int i) {
+    stat_add(pq, STAT_EXTRACTS, 1);
+    if (pq->heap[i].handle >= 0) {
+        release_handle(pq, pq->heap[i].handle);
+    }
+    minmax_remove(pq->heap, pq->size, pq->handles, i);
+    pq->size--;
+    atomic_dec(&pq->count);
+    shrink_pq(pq);
+}
+
+// A relaxed queue spreads its elements over relaxed_factor sub-heaps per CPU, each an
+// ordinary priority_queue with its own lock. Insertions go to a sub-heap of the local
+// CPU (batches are spread, see relaxed_push()) and extractions take the better top of
+// two randomly chosen sub-heaps, so neither serializes on a single lock. In exchange
+// an extraction is only approximately ordered: with m sub-heaps the element returned
+// has an expected rank (its position in the strict order) of O(m) and a rank of
+// O(m log m) with high probability, as long as the elements are spread about evenly
+// over the sub-heaps. Elements of equal priority may not leave in FIFO order. The
+// parent queue keeps the element count, insert times and wait queues.
+
+// Publish the keys of a sub-heap's minimum and maximum, called with its lock held
+static void update_keys(struct priority_queue *sub) {
+    struct element *max_elem;
+
+    if (sub->size == 0) {
+        WRITE_ONCE(sub->min_key, U64_MAX);
+        WRITE_ONCE(sub->max_key, 0);
+    } else {
+        max_elem = &sub->heap[minmax_max_index(sub->heap, sub->size)];
+        WRITE_ONCE(sub->min_key, pack_key(sub->heap[0].priority, sub->heap[0].insert_time));
+        WRITE_ONCE(sub->max_key, pack_key(max_elem->priority, max_elem->insert_time));
+    }
+}
+
+static int create_subs(struct priority_queue *pq) {
+    int i, nr = max(relaxed_factor, 1) * nr_cpu_ids;
+
+    pq->subs = kvmalloc_array(nr, sizeof(struct priority_queue), GFP_KERNEL);
+    if (pq->subs == NULL) {
+        printk(KERN_ALERT "Error: could not allocate memory for relaxed sub-heaps\n");
+        return -ENOMEM;
+    }
+    for (i = 0; i < nr; i++) {
+        init_pq(&pq->subs[i]);
+        // Inserts and extractions of rings and combiners lock a sub-heap with the parent held
+        lockdep_set_class(&pq->subs[i].lock, &sub_lock_key);
+        pq->subs[i].capacity = PQ_UNBOUNDED;
+        pq->subs[i].stats = pq->stats;
+    }
+    pq->nr_subs = nr;
+    // The elements live in the sub-heaps only
+    free_heap(pq);
+    return 0;
+}
+
+// Insert n elements whose slots have been reserved. A single element goes to a sub-heap
+// of the local CPU, larger batches are split into runs over random sub-heaps because
+// one sub-heap holding a large share of the elements would inflate the rank error.
+static int relaxed_push(struct priority_queue *pq, struct pb2_pair *pairs, int n) {
+    int per_cpu = pq->nr_subs / nr_cpu_ids;
+    struct priority_queue *sub;
+    int i, run, first_time;
+
+    while (n > 0) {
+        run = min(n, PQ_RELAXED_RUN);
+        if (n == 1) {
+            // Only a hint, being migrated before taking the lock is harmless
+            sub = &pq->subs[raw_smp_processor_id() * per_cpu + get_random_u32_below(per_cpu)];
+        } else {
+            sub = &pq->subs[get_random_u32_below(pq->nr_subs)];
+        }
+        lock_queue(sub);
+        if (reserve_pq(sub, sub->size + run) < 0) {
+            // The runs already inserted stay in the queue
+            mutex_unlock(&sub->lock);
+            release_slots(pq, n);
+            return -ENOMEM;
+        }
+        first_time = take_times(pq, run);
+        for (i = 0; i < run; i++) {
+            heap_push(sub, pairs[i].val, pairs[i].priority, first_time + i, -1);
+        }
+        atomic_add(run, &sub->count);
+        update_keys(sub);
+        mutex_unlock(&sub->lock);
+        wake_up_interruptible_nr(&pq->readq, run);
+        pairs += run;
+        n -= run;
+    }
+    return 0;
+}
+
+// Take the minimum or maximum of a sub-heap, giving up if its lock is contended unless wait is set
+static int relaxed_take(struct priority_queue *pq, struct priority_queue *sub, struct element *elem, int largest, int wait) {
+    int i;
+
+    if (READ_ONCE(sub->min_key) == U64_MAX) {
+        return -EACCES;
+    }
+    if (wait) {
+        lock_queue(sub);
+    } else if (!mutex_trylock(&sub->lock)) {
+        return -EBUSY;
+    }
+    if (sub->size == 0) {
+        mutex_unlock(&sub->lock);
+        return -EACCES;
+    }
+    i = largest ? minmax_max_index(sub->heap, sub->size) : 0;
+    *elem = sub->heap[i];
+    remove_at(sub, i);
+    update_keys(sub);
+    mutex_unlock(&sub->lock);
+    release_slots(pq, 1);
+    return 0;
+}
+
+// Extract an element close to the minimum (or maximum) of a relaxed queue
+static int relaxed_extract(struct priority_queue *pq, struct element *elem, int largest) {
+    struct priority_queue *a, *b;
+    int i;
+
+    for (i = 0; i < pq->nr_subs; i++) {
+        a = &pq->subs[get_random_u32_below(pq->nr_subs)];
+        b = &pq->subs[get_random_u32_below(pq->nr_subs)];
+        if (largest ? READ_ONCE(b->max_key) > READ_ONCE(a->max_key) : READ_ONCE(b->min_key) < READ_ONCE(a->min_key)) {
+            a = b;
+        }
+        if (relaxed_take(pq, a, elem, largest, 0) == 0) {
+            return 0;
+        }
+    }
+    // Nearly empty or heavily contended, visit every sub-heap once before giving up
+    for (i = 0; i < pq->nr_subs; i++) {
+        if (relaxed_take(pq, &pq->subs[i], elem, largest, 1) == 0) {
+            return 0;
+        }
+    }
+    pr_debug("Error: priority queue is empty\n");
+    return -EACCES;
+}
+
+// Insert an element into a slot reserved by reserve_slots() or wait_space(), the slot is
+// given back if the element cannot be inserted
+static int insert(struct priority_queue *pq, int val, int priority) {
+    struct pb2_pair pair = {val, priority};
+
+    if (pq->subs != NULL) {
+        return relaxed_push(pq, &pair, 1);
+    }
+    if (reserve_pq(pq, pq->size + 1) < 0) {
+        release_slots(pq, 1);
+        return -ENOMEM;
+    }
+    heap_push(pq, val, priority, take_times(pq, 1), -1);
+    return 0;
+}
+
+// Move the chunks staged by lock-free producers into the heap, called right after
+// taking the lock so that every operation sees all elements inserted before it. The chunks
+// are merged oldest first, so a bucket queue appends them without walking back past newer ones.
+static void merge_staged(struct priority_queue *pq) {
+    struct llist_node *list = llist_reverse_order(llist_del_all(&pq->staged));
+    struct pb2_chunk *chunk, *next;
+    int i, failed = 0;
+
+    llist_for_each_entry_safe(chunk, next, list, node) {
+        if (failed || reserve_pq(pq, pq->size + chunk->n) < 0) {
+            // Keep the chunk staged, its slots stay reserved until a later merge succeeds
+            failed = 1;
+            llist_add(&chunk->node, &pq->staged);
+            continue;
+        }
+        for (i = 0; i < chunk->n; i++) {
+            heap_push(pq, chunk->pairs[i].val, chunk->pairs[i].priority, chunk->first_time + i, -1);
+        }
+        // The producer already woke consumers for these elements
+        pq->notified_size += chunk->n;
+        kvfree(chunk);
+    }
+}
+
+static struct pb2_chunk *alloc_chunk(int n) {
+    struct pb2_chunk *chunk = kvmalloc(struct_size(chunk, pairs, n), GFP_KERNEL);
+    if (chunk == NULL) {
+        printk(KERN_ALERT "Error: could not allocate memory for staged elements\n");
+        return NULL;
+    }
+    chunk->n = n;
+    return chunk;
+}
+
+// Fill a chunk from a user array of pairs, validating the whole batch before anything is inserted
+static int copy_chunk(struct priority_queue *pq, struct pb2_chunk *chunk, struct pb2_pair *pairs) {
+    int i;
+    if (copy_from_user(chunk->pairs, pairs, chunk->n * sizeof(struct pb2_pair)) != 0) {
+        pr_debug("Error: could not copy batch pairs from user\n");
+        return -EINVAL;
+    }
+    for (i = 0; i < chunk->n; i++) {
+        if (chunk->pairs[i].priority < 1 || chunk->pairs[i].priority > pq_max_priority(pq)) {
+            pr_debug("Error: Priority must be between 1 and %d\n", pq_max_priority(pq));
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+// Publish a chunk whose slots have been reserved, safe without the lock
+static void stage_chunk(struct priority_queue *pq, struct pb2_chunk *chunk) {
+    chunk->first_time = take_times(pq, chunk->n);
+    llist_add(&chunk->node, &pq->staged);
+    // Consumers only see staged elements once they take the lock, wake them to merge these
+    wake_up_interruptible_nr(&pq->readq, chunk->n);
+}
+
+// Extract the minimum element from the priority queue
+static int extract_min(struct priority_queue *pq, struct element *min_elem) {
+    if (pq->subs != NULL) {
+        return relaxed_extract(pq, min_elem, 0);
+    }
+    if (pq->size == 0) {
+        pr_debug("Error: priority queue is empty\n");
+        return -EACCES;
+    }
+    if (pq->backend == PB2_BACKEND_DARY) {
+        dary_remove(pq, 0, min_elem);
+        return 0;
+    } else if (pq->backend == PB2_BACKEND_PAIRING) {
+        pairing_remove(pq, pq->root, 0, min_elem);
+        return 0;
+    } else if (pq->backend == PB2_BACKEND_BUCKET) {
+        bucket_remove(pq, 0, min_elem);
+        return 0;
+    }
+    *min_elem = pq->heap[0];
+    remove_at(pq, 0);
+    return 0;
+}
+
+// Extract the maximum element from the priority queue
+static int extract_max(struct priority_queue *pq, struct element *max_elem) {
+    struct pq_node *node;
+    int max_ind, shift;
+
+    if (pq->subs != NULL) {
+        return relaxed_extract(pq, max_elem, 1);
+    }
+    if (pq->size == 0) {
+        pr_debug("Error: priority queue is empty\n");
+        return -EACCES;
+    }
+    if (pq->backend == PB2_BACKEND_DARY) {
+        dary_remove(pq, dary_max_index(pq), max_elem);
+        return 0;
+    } else if (pq->backend == PB2_BACKEND_PAIRING) {
+        node = pairing_max(pq, &shift);
+        pairing_remove(pq, node, shift, max_elem);
+        return 0;
+    } else if (pq->backend == PB2_BACKEND_BUCKET) {
+        bucket_remove(pq, 1, max_elem);
+        return 0;
+    }
+    max_ind = minmax_max_index(pq->heap, pq->size);
+    *max_elem = pq->heap[max_ind];
+    remove_at(pq, max_ind);
+    return 0;
+}
+
+// Priority of the maximum element of a non-empty strict queue
+static int top_priority(struct priority_queue *pq) {
+    int shift;
+
+    if (pq->backend == PB2_BACKEND_DARY) {
+        return pq->keys[dary_max_index(pq)] >> 32;
+    } else if (pq->backend == PB2_BACKEND_PAIRING) {
+        return pairing_max(pq, &shift)->elem.priority;
+    } else if (pq->backend == PB2_BACKEND_BUCKET) {
+        return find_last_bit(pq->buckets->map, PQ_BUCKET_PRIOS) + 1;
+    }
+    return pq->heap[minmax_max_index(pq->heap, pq->size)].priority;
+}
+
+// Print priority queue
+static void print_pq(struct priority_queue *pq) {
+#ifdef DEBUG
+    printk(KERN_INFO "Priority queue for process %d:\n", current->pid);
+    if (pq != NULL && pq->heap != NULL) {
+        int i;
+        for (i = 0; i < pq->size; i++) {
+            printk(KERN_INFO "%d  [%d, %d, %d]\n", i, pq->heap[i].val, pq->heap[i].priority, pq->heap[i].insert_time);
+        }
+    } else if (pq != NULL && pq->keys != NULL) {
+        int i;
+        for (i = 0; i < pq->size; i++) {
+            printk(KERN_INFO "%d  [%d, %d, %d]\n", i, pq->vals[i], (int)(pq->keys[i] >> 32), (int)(u32)pq->keys[i]);
+        }
+    } else if (pq != NULL && pq->root != NULL) {
+        struct pq_node *node;
+        int i = 0, shift = 0;
+        for (node = pq->root; node != NULL; node = pairing_next(node, &shift)) {
+            printk(KERN_INFO "%d  [%d, %d, %d]\n", i++, node->elem.val, node->elem.priority, node->elem.insert_time + shift);
+        }
+    } else if (pq != NULL && pq->buckets != NULL) {
+        struct pq_node *node;
+        int b, i = 0;
+        for_each_set_bit(b, pq->buckets->map, PQ_BUCKET_PRIOS) {
+            node = pq->buckets->head[b];
+            do {
+                printk(KERN_INFO "%d  [%d, %d, %d]\n", i++, node->elem.val, node->elem.priority, node->elem.insert_time);
+                node = node->next;
+            } while (node != pq->buckets->head[b]);
+        }
+    }
+    printk("\n");
+#endif
+}
+
+// Free the memory allocated to the priority queue
+static void delete_pq(struct priority_queue *pq) {
+    struct pb2_chunk *chunk, *next;
+    int i;
+
+    if (pq != NULL) {
+        for (i = 0; i < pq->nr_subs; i++) {
+            mutex_destroy(&pq->subs[i].lock);
+            free_heap(&pq->subs[i]);
+        }
+        kvfree(pq->subs);
+        llist_for_each_entry_safe(chunk, next, llist_del_all(&pq->staged), node) {
+            kvfree(chunk);
+        }
+        mutex_destroy(&pq->lock);
+        free_heap(pq);
+        free_handles(pq);
+        free_percpu(pq->stats);
+        free_percpu(pq->fc_slots);
+        kmem_cache_free(pq_cache, pq);
+    }
+}
+
+// Move all elements of src into dst, whose slots have been reserved, src must not be empty.
+// The elements get insert times after those already in dst, so ties still leave in a stable
+// order, and src is left empty with its clock restarted as after a reset. Two pairing heaps
+// are melded in O(1): every insert time of src lies in [0, src->timer), so shifting them all
+// by the first of src->timer times taken from dst keeps the tree ordered, and the shift is
+// put on the root, see pairing_link(). Other queues are moved element by element in
+// priority order.
+static int meld(struct priority_queue *dst, struct priority_queue *src) {
+    struct element elem;
+    int i, n = src->size, first_time;
+
+    if (dst->backend == PB2_BACKEND_PAIRING && src->backend == PB2_BACKEND_PAIRING) {
+        first_time = take_times(dst, atomic_read(&src->timer));
+        atomic_set(&src->timer, 0);
+        src->root->elem.insert_time += first_time;
+        src->root->shift += first_time;
+        dst->root = pairing_link(dst->root, src->root);
+        src->root = NULL;
+        // The nodes move with their elements, the spare nodes stay where they are
+        dst->size += n;
+        dst->alloc += n;
+        WRITE_ONCE(dst->memory, dst->memory + (long)n * sizeof(struct pq_node));
+        src->size = 0;
+        src->alloc -= n;
+        WRITE_ONCE(src->memory, src->memory - (long)n * sizeof(struct pq_node));
+        atomic_sub(n, &src->count);
+        shrink_pq(src);
+        stat_add(src, STAT_EXTRACTS, n);
+        stat_add(dst, STAT_INSERTS, n);
+        return 0;
+    }
+    if (reserve_pq(dst, dst->size + n) < 0) {
+        return -ENOMEM;
+    }
+    first_time = take_times(dst, n);
+    for (i = 0; i < n; i++) {
+        extract_min(src, &elem);
+        heap_push(dst, elem.val, elem.priority, first_time + i, -1);
+    }
+    atomic_set(&src->timer, 0);
+    return 0;
+}
+
+// Ring functions
+
+// Allocate a zeroed, mmap()-able ring area, sizes must be powers of two
+static struct pb2_ring *create_ring(struct pb2_ring_params *params) {
+    struct pb2_ring *ring = kmalloc(sizeof(struct pb2_ring), GFP_KERNEL);
+    if (ring == NULL) {
+        return NULL;
+    }
+    params->sq_off = ALIGN(sizeof(struct pb2_ring_hdr), 64);
+    params->cq_off = ALIGN(params->sq_off + params->sq_entries * sizeof(struct pb2_sqe), 64);
+    params->ring_size = PAGE_ALIGN(params->cq_off + params->cq_entries * sizeof(struct pb2_cqe));
+    ring->mem = vmalloc_user(params->ring_size);
+    if (ring->mem == NULL) {
+        kfree(ring);
+        return NULL;
+    }
+    ring->hdr = ring->mem;
+    ring->sqes = ring->mem + params->sq_off;
+    ring->cqes = ring->mem + params->cq_off;
+    ring->sq_entries = params->sq_entries;
+    ring->cq_entries = params->cq_entries;
+    ring->sq_head = 0;
+    ring->cq_tail = 0;
+    ring->hdr->sq_mask = ring->sq_entries - 1;
+    ring->hdr->cq_mask = ring->cq_entries - 1;
+    return ring;
+}
+
+static void delete_ring(struct pb2_ring *ring) {
+    if (ring != NULL) {
+        vfree(ring->mem);
+        kfree(ring);
+    }
+}
+
+// Run one submission against the queue and fill in its completion
+static void run_sqe(struct priority_queue *pq, struct pb2_sqe *sqe, struct pb2_cqe *cqe) {
+    struct element elem = {0, 0, 0};
+    uint32_t opcode = READ_ONCE(sqe->opcode);
+    int32_t val = READ_ONCE(sqe->val);
+    int32_t priority = READ_ONCE(sqe->priority);
+    int res;
+
+    if (opcode == PB2_OP_INSERT) {
+        if (priority < 1 || priority > pq_max_priority(pq)) {
+            res = -EINVAL;
+        } else if (pq->space_waiters > 0 || reserve_slots(pq, 1) == 0) {
+            // Producers blocked in wait_space() are served first
+            pr_debug("Error: priority queue is full\n");
+            stat_add(pq, STAT_FULL, 1);
+            res = -EACCES;
+        } else {
+            res = insert(pq, val, priority);
+        }
+    } else if (opcode == PB2_OP_GET_MIN || opcode == PB2_OP_GET_MAX) {
+        res = opcode == PB2_OP_GET_MIN ? extract_min(pq, &elem) : extract_max(pq, &elem);
+        if (res == -EACCES) {
+            stat_add(pq, STAT_EMPTY, 1);
+        }
+    } else {
+        res = -EINVAL;
+    }
+    cqe->user_data = READ_ONCE(sqe->user_data);
+    cqe->res = res;
+    cqe->val = elem.val;
+    cqe->priority = elem.priority;
+    cqe->insert_time = elem.insert_time;
+}
+
+// Flat combining for PB2_MODE_COMBINE files. Instead of every contender sleeping on the
+// queue lock and taking its turn, a thread publishes its request in the slot of its CPU
+// and whoever holds the lock serves all published requests in one pass, so the heap
+// stays in the cache of one core and most requests never touch the lock.
+
+// Allocate the combining slots of a queue once, safe without its lock
+static int enable_combining(struct priority_queue *pq) {
+    struct pb2_fc_slot __percpu *slots;
+
+    if (READ_ONCE(pq->fc_slots) != NULL) {
+        return 0;
+    }
+    slots = alloc_percpu(struct pb2_fc_slot);
+    if (slots == NULL) {
+        printk(KERN_ALERT "Error: could not allocate memory for combining slots\n");
+        return -ENOMEM;
+    }
+    // Another file may have enabled it meanwhile
+    if (cmpxchg(&pq->fc_slots, NULL, slots) != NULL) {
+        free_percpu(slots);
+    }
+    return 0;
+}
+
+// Serve every published request, inserts first so that the extractions of the same pass
+// see the new elements. Called with the queue lock held, right after merge_staged().
+static void combine_pass(struct priority_queue *pq) {
+    struct pb2_fc_slot *slot;
+    int cpu, inserts, served = 0;
+
+    for (inserts = 1; inserts >= 0; inserts--) {
+        for_each_possible_cpu(cpu) {
+            slot = per_cpu_ptr(pq->fc_slots, cpu);
+            // Pairs with the release store of the owner, its sqe is visible once the state is
+            if (smp_load_acquire(&slot->state) != FC_PENDING || (slot->sqe.opcode == PB2_OP_INSERT) != inserts) {
+                continue;
+            }
+            run_sqe(pq, &slot->sqe, &slot->cqe);
+            smp_store_release(&slot->state, FC_DONE);
+            served++;
+        }
+    }
+    stat_add(pq, STAT_COMBINED, served);
+}
+
+// Pass a wakeup of the readq or writeq of a queue on to the pollers of a file using it
+static int poll_forward(struct wait_queue_entry *wait, unsigned int mode, int sync, void *key) {
+    struct process_node *curr = wait->private;
+
+    wake_up_interruptible(&curr->pollq);
+    return 0;
+}
+
+// Put the forwarding entries of a polled file on the wait queues of pq, or take them off
+static void hook_poll(struct process_node *curr, struct priority_queue *pq, int add) {
+    if (add) {
+        add_wait_queue(&pq->readq, &curr->poll_read);
+        add_wait_queue(&pq->writeq, &curr->poll_write);
+    } else {
+        remove_wait_queue(&pq->readq, &curr->poll_read);
+        remove_wait_queue(&pq->writeq, &curr->poll_write);
+    }
+}
+
+// Allocate the state for a new open of the proc file
+static struct process_node *create_process_node(pid_t pid, struct file *file) {
+    struct process_node *node = kmem_cache_alloc(node_cache, GFP_KERNEL);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->pid = pid;
+    node->file = file;
+    node->state = PROC_FILE_OPEN;
+    node->mode = 0;
+    xa_init(&node->pending);
+    node->ring = NULL;
+    init_waitqueue_head(&node->pollq);
+    init_waitqueue_func_entry(&node->poll_read, poll_forward);
+    init_waitqueue_func_entry(&node->poll_write, poll_forward);
+    node->poll_read.private = node;
+    node->poll_write.private = node;
+    node->polled = 0;
+    node->own_pq = create_pq();
+    if (node->own_pq == NULL) {
+        kmem_cache_free(node_cache, node);
+        return NULL;
+    }
+    node->proc_pq = node->own_pq;
+    return node;
+}
+
+// Called by kref_put_mutex() with named_lock held once the last attached file is gone
+static void release_named_pq(struct kref *ref) {
+    struct priority_queue *pq = container_of(ref, struct priority_queue, ref);
+    list_del(&pq->list);
+    mutex_unlock(&named_lock);
+    pr_debug("Named priority queue %s has been freed\n", pq->name);
+    delete_pq(pq);
+}
+
+// Free the memory allocated to a process node
+static void delete_process_node(struct process_node *node) {
+    if (node != NULL) {
+        delete_ring(node->ring);
+        if (node->polled) {
+            hook_poll(node, node->proc_pq, 0);
+        }
+        if (node->proc_pq != node->own_pq) {
+            kref_put_mutex(&node->proc_pq->ref, release_named_pq, &named_lock);
+        }
+        delete_pq(node->own_pq);
+        xa_destroy(&node->pending);
+        kmem_cache_free(node_cache, node);
+    }
+}
+
+// Lock the queue the file currently uses. PB2_ATTACH switches proc_pq while holding the
+// lock of own_pq, which stays allocated, so a thread that locked the old queue notices
+// the switch and moves over. Staged elements are merged and combining requests served
+// before the caller sees the heap.
+static struct priority_queue *lock_pq(struct process_node *curr) {
+    struct priority_queue *pq;
+
+    for (;;) {
+        pq = READ_ONCE(curr->proc_pq);
+        lock_queue(pq);
+        if (pq == READ_ONCE(curr->proc_pq)) {
+            break;
+        }
+        mutex_unlock(&pq->lock);
+    }
+    merge_staged(pq);
+    if (pq->fc_slots != NULL) {
+        combine_pass(pq);
+    }
+    return pq;
+}
+
+// Lock the queues of two files, in address order so that melds in opposite directions
+// cannot deadlock. Retries like lock_pq() if either file switched queues meanwhile.
+static void lock_two(struct process_node *a, struct process_node *b, struct priority_queue **pa, struct priority_queue **pb) {
+    for (;;) {
+        *pa = READ_ONCE(a->proc_pq);
+        *pb = READ_ONCE(b->proc_pq);
+        if (*pa == *pb) {
+            lock_queue(*pa);
+        } else if (*pa < *pb) {
+            lock_queue(*pa);
+            mutex_lock_nested(&(*pb)->lock, SINGLE_DEPTH_NESTING);
+        } else {
+            lock_queue(*pb);
+            mutex_lock_nested(&(*pa)->lock, SINGLE_DEPTH_NESTING);
+        }
+        if (*pa == READ_ONCE(a->proc_pq) && *pb == READ_ONCE(b->proc_pq)) {
+            break;
+        }
+        if (*pa != *pb) {
+            mutex_unlock(&(*pb)->lock);
+        }
+        mutex_unlock(&(*pa)->lock);
+    }
+    merge_staged(*pa);
+    if (*pa != *pb) {
+        merge_staged(*pb);
+    }
+}
+
+// Open, close handlers for proc file
+
+// Open handler for proc file
+static int procfile_open(struct inode *inode, struct file *file) {
+    struct process_node *curr;
+
+    pr_debug("procfile_open() invoked by process %d\n", current->pid);
+
+    // Every open gets its own queue, reached through file->private_data
+    curr = create_process_node(current->pid, file);
+    if (curr == NULL) {
+        printk(KERN_ALERT "Error: could not allocate memory for process node\n");
+        return -ENOMEM;
+    }
+    file->private_data = curr;
+    pr_debug("Process %d has opened the proc file\n", current->pid);
+    return 0;
+}
+
+// Close handler for proc file
+static int procfile_close(struct inode *inode, struct file *file) {
+    pr_debug("procfile_close() invoked by process %d\n", current->pid);
+
+    // Called once for the last reference to the file, no other operation can be running on it
+    delete_process_node(file->private_data);
+    file->private_data = NULL;
+    return 0;
+}
+
+// Blocking support, called with the queue lock held
+
+// Wake as many consumers or producers as the size changed by since the last call, poll()
+// waiters always wake. Called before every release of the lock, so no change is missed.
+static void wake_waiters(struct priority_queue *pq) {
+    int freed = pq->notified_size - pq->size;
+    int n;
+
+    if (freed < 0) {
+        wake_up_interruptible_nr(&pq->readq, -freed);
+    } else if (freed > 0) {
+        // Reserved again to be handed to the producers waiting in wait_space()
+        n = pq->space_waiters > 0 ? reserve_slots(pq, freed) : 0;
+        if (n > 0) {
+            release_slots(pq, n);
+        } else {
+            wake_up_interruptible_nr(&pq->writeq, freed);
+        }
+    }
+    pq->notified_size = pq->size;
+}
+
+// Whether an extraction would find an element, read without the lock. Unlike count, this
+// leaves out slots reserved by inserts that have not put their element in the queue yet.
+static int pq_readable(struct priority_queue *pq) {
+    int i;
+
+    if (pq->subs != NULL) {
+        for (i = 0; i < pq->nr_subs; i++) {
+            if (READ_ONCE(pq->subs[i].min_key) != U64_MAX) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    // notified_size is the size at the last release of the lock, staged chunks are merged by the next extraction
+    return READ_ONCE(pq->notified_size) > 0 || !llist_empty(&pq->staged);
+}
+
+// Whether a waiter on wq may find its condition met by changes made without the lock:
+// staged or relaxed inserts for consumers, relaxed extractions for producers
+static int pq_ready(struct priority_queue *pq, wait_queue_head_t *wq) {
+    if (wq == &pq->readq) {
+        return !llist_empty(&pq->staged) || (pq->subs != NULL && pq_readable(pq));
+    }
+    return !pq_full(pq);
+}
+
+// Drop the lock and sleep on wq until woken, interrupted or *timeout jiffies have passed.
+// Exclusive waiters queue at the tail and are woken in that order, one per change. A
+// consumer still has to retake the lock and a newcomer may take the element first, a
+// producer is handed its slot by the wakeup itself, see release_slots().
+static int sleep_unlocked(struct priority_queue *pq, wait_queue_head_t *wq, struct wait_queue_entry *wait, long *timeout) {
+    wake_waiters(pq);
+    // Queued before the lock is released, so a wakeup for a change made after that cannot be missed
+    prepare_to_wait_exclusive(wq, wait, TASK_INTERRUPTIBLE);
+    mutex_unlock(&pq->lock);
+    // Changes made without the lock before we were queued woke nobody, look at them instead of sleeping
+    if (!signal_pending(current) && !pq_ready(pq, wq)) {
+        *timeout = schedule_timeout(*timeout);
+    }
+    finish_wait(wq, wait);
+    mutex_lock(&pq->lock);
+    merge_staged(pq);
+    if (signal_pending(current)) {
+        // The wakeup may have been meant for us, pass it on to the next consumer. A producer
+        // gives back the slot it was handed instead.
+        if (wq == &pq->readq) {
+            wake_up_interruptible(wq);
+        }
+        return -ERESTARTSYS;
+    }
+    return 0;
+}
+
+// Wait until the queue has an element, only in PB2_MODE_BLOCK_READ mode and without O_NONBLOCK
+static int wait_nonempty(struct process_node *curr) {
+    struct priority_queue *pq = curr->proc_pq;
+    long timeout = MAX_SCHEDULE_TIMEOUT;
+    DEFINE_WAIT(wait);
+    int ret;
+
+    while (pq_size(pq) == 0) {
+        if (!(curr->mode & PB2_MODE_BLOCK_READ)) {
+            pr_debug("Error: priority queue is empty\n");
+            stat_add(pq, STAT_EMPTY, 1);
+            return -EACCES;
+        }
+        if (curr->file->f_flags & O_NONBLOCK) {
+            stat_add(pq, STAT_EMPTY, 1);
+            return -EAGAIN;
+        }
+        ret = sleep_unlocked(pq, &pq->readq, &wait, &timeout);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+// Wake function of producers sleeping in wait_space(). A wakeup from release_slots() hands
+// each producer it wakes one slot, set before the wakeup as the producer may return at once.
+static int space_wake(struct wait_queue_entry *wait, unsigned int mode, int sync, void *key) {
+    struct space_wait *sw = container_of(wait, struct space_wait, wait);
+    struct space_grant *grant = key;
+
+    if (grant != NULL && grant->left > 0 && !sw->granted) {
+        sw->granted = 1;
+        grant->left--;
+        autoremove_wake_function(wait, mode, sync, key);
+        // Counts as woken even if the producer was running already, it finds the slot anyway
+        return 1;
+    }
+    return autoremove_wake_function(wait, mode, sync, key);
+}
+
+// Reserve up to n free slots, waiting for one if block is set, for at most timeout jiffies.
+// Returns the number reserved. Producers are served in the order they started waiting:
+// a newcomer queues behind them, and each is handed the slot it is woken for, so neither
+// a newcomer nor a lock-free insert can take it before the producer retakes the lock.
+static int wait_space(struct process_node *curr, int n, int block, long timeout) {
+    struct priority_queue *pq = curr->proc_pq;
+    struct space_wait sw;
+    int reserved = 0, ret = 0;
+
+    if (pq->space_waiters == 0) {
+        reserved = reserve_slots(pq, n);
+    }
+    if (reserved > 0) {
+        return reserved;
+    }
+    if (!block) {
+        pr_debug("Error: priority queue is full\n");
+        stat_add(pq, STAT_FULL, 1);
+        return -EACCES;
+    }
+    if (curr->file->f_flags & O_NONBLOCK) {
+        stat_add(pq, STAT_FULL, 1);
+        return -EAGAIN;
+    }
+    init_wait_func(&sw.wait, space_wake);
+    sw.granted = 0;
+    WRITE_ONCE(pq->space_waiters, pq->space_waiters + 1);
+    while (!sw.granted && reserved == 0 && ret == 0) {
+        if (timeout == 0) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        ret = sleep_unlocked(pq, &pq->writeq, &sw.wait, &timeout);
+        // Woken without a slot by a wakeup that had none to hand out, or that came before we queued
+        if (!sw.granted && ret == 0) {
+            reserved = reserve_slots(pq, n);
+        }
+    }
+    WRITE_ONCE(pq->space_waiters, pq->space_waiters - 1);
+    if (sw.granted) {
+        if (ret < 0) {
+            release_slots(pq, 1);
+            return ret;
+        }
+        // The rest of a batch only takes slots no other producer is waiting for
+        reserved = 1;
+        if (n > 1 && pq->space_waiters == 0) {
+            reserved += reserve_slots(pq, n - 1);
+        }
+        return reserved;
+    }
+    if (ret == -ETIMEDOUT) {
+        pr_debug("Error: timed out waiting for space in the priority queue\n");
+        stat_add(pq, STAT_FULL, 1);
+    }
+    return ret < 0 ? ret : reserved;
+}
+
+// Run sqe through the combining slots of pq and fill in cqe. The request is published in
+// the slot of the local CPU, then its owner polls for a combiner to serve it, or becomes
+// the combiner when the lock is free. An owner that polled FC_SPINS times, or should give
+// up the CPU, sleeps on the lock instead. Returns PQ_NEED_LOCK if pq has no slots or the
+// slot is taken by a thread preempted on this CPU, the caller then takes the locked path.
+static int combine(struct priority_queue *pq, struct pb2_sqe *sqe, struct pb2_cqe *cqe) {
+    struct pb2_fc_slot __percpu *slots = READ_ONCE(pq->fc_slots);
+    struct pb2_fc_slot *slot;
+    int spins = 0;
+
+    if (slots == NULL) {
+        return PQ_NEED_LOCK;
+    }
+    // Any slot works if the thread migrates meanwhile, the claim is what makes it ours
+    slot = raw_cpu_ptr(slots);
+    if (cmpxchg(&slot->state, FC_FREE, FC_FILLING) != FC_FREE) {
+        return PQ_NEED_LOCK;
+    }
+    slot->sqe = *sqe;
+    smp_store_release(&slot->state, FC_PENDING);
+
+    while (smp_load_acquire(&slot->state) != FC_DONE) {
+        if (!mutex_trylock(&pq->lock)) {
+            if (++spins < FC_SPINS && !need_resched()) {
+                cpu_relax();
+                continue;
+            }
+            lock_queue(pq);
+        }
+        merge_staged(pq);
+        combine_pass(pq);
+        wake_waiters(pq);
+        mutex_unlock(&pq->lock);
+    }
+    *cqe = slot->cqe;
+    smp_store_release(&slot->state, FC_FREE);
+    return 0;
+}
+
+// Whether the calling thread has sent a value with PB2_INSERT_INT and owes its priority
+static int has_pending(struct process_node *curr) {
+    return xa_load(&curr->pending, current->pid) != NULL;
+}
+
+static long pb2_set_capacity(unsigned long arg, struct process_node *curr) {
+    int32_t capacity;
+
+    pr_debug("PB2_SET_CAPACITY invoked by process %d\n", curr->pid);
+    if (copy_from_user(&capacity, (int32_t *)arg, sizeof(int32_t)) != 0) {
+        pr_debug("Error: could not copy capacity from user\n");
+        return -EINVAL;
+    }
+    if (!pq_valid_capacity(capacity)) {
+        pr_debug("Error: Capacity must be between 1 and %d, or %d for an unbounded queue\n", PQ_MAX_CAPACITY, PQ_UNBOUNDED);
+        return -EINVAL;
+    }
+    // The capacity of a named queue is fixed when it is created
+    if (curr->proc_pq != curr->own_pq) {
+        pr_debug("Error: process %d cannot change the capacity of named queue %s\n", curr->pid, curr->proc_pq->name);
+        return -EBUSY;
+    }
+    if (curr->state != PROC_FILE_OPEN) {
+        pr_debug("Resetting priority queue for process %d\n", curr->pid);
+    }
+    xa_destroy(&curr->pending);
+    if (reset_pq(curr->proc_pq, capacity) < 0) {
+        printk(KERN_ALERT "Error: priority queue initialization failed\n");
+        curr->state = PROC_FILE_OPEN;
+        return -ENOMEM;
+    }
+    pr_debug("Priority queue with capacity %d has been intialized for process %d\n", capacity, curr->pid);
+    curr->state = PROC_READ_VALUE;
+    return 0;
+}
+
+static long pb2_insert_int(unsigned long arg, struct process_node *curr) {
+    int32_t value;
+
+    pr_debug("PB2_INSERT_INT invoked by process %d\n", curr->pid);
+    if (copy_from_user(&value, (int32_t *)arg, sizeof(int32_t)) != 0) {
+        pr_debug("Error: could not copy value from user\n");
+        return -EINVAL;
+    }
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not set the capacity of the priority queue\n", curr->pid);
+        return -EACCES;
+    } else if (has_pending(curr)) {
+        pr_debug("Error: thread %d is supposed to enter priority, not a value\n", current->pid);
+        return -EACCES;
+    }
+    // A value entry holds LONG_MAX >> 1 at most, every u32 fits only with 64-bit longs
+    BUILD_BUG_ON(BITS_PER_LONG < 64);
+    if (xa_err(xa_store(&curr->pending, current->pid, xa_mk_value((u32)value), GFP_KERNEL)) < 0) {
+        return -ENOMEM;
+    }
+    pr_debug("Value %d has been written to the proc file by thread %d\n", value, current->pid);
+    return 0;
+}
+
+static long pb2_insert_prio(unsigned long arg, struct process_node *curr) {
+    int32_t prio;
+    void *entry;
+    int value, ret;
+
+    pr_debug("PB2_INSERT_PRIO invoked by process %d\n", curr->pid);
+    if (copy_from_user(&prio, (int32_t *)arg, sizeof(int32_t)) != 0) {
+        pr_debug("Error: could not copy priority from user\n");
+        return -EINVAL;
+    }
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not set the capacity of the priority queue\n", curr->pid);
+        return -EACCES;
+    } else if (!has_pending(curr)) {
+        pr_debug("Error: thread %d is supposed to enter a value, not priority\n", current->pid);
+        return -EACCES;
+    }
+    if (prio < 1 || prio > pq_max_priority(curr->proc_pq)) {
+        pr_debug("Error: Priority must be between 1 and %d\n", pq_max_priority(curr->proc_pq));
+        return -EINVAL;
+    }
+    ret = wait_space(curr, 1, curr->mode & PB2_MODE_BLOCK_WRITE, MAX_SCHEDULE_TIMEOUT);
+    if (ret < 0) {
+        return ret;
+    }
+    // The queue may have been reset by a thread sharing the file while this one slept
+    entry = xa_load(&curr->pending, current->pid);
+    if (entry == NULL) {
+        pr_debug("Error: priority queue of process %d was reset\n", curr->pid);
+        release_slots(curr->proc_pq, 1);
+        return -EACCES;
+    }
+    value = (u32)xa_to_value(entry);
+    pr_debug("Priority %d has been written to the proc file by thread %d\n", prio, current->pid);
+    ret = insert(curr->proc_pq, value, prio);
+    if (ret < 0) {
+        return ret;
+    }
+    xa_erase(&curr->pending, current->pid);
+    pr_debug("(%d, %d) value-priority element has been inserted into the priority queue for process %d\n", value, prio, curr->pid);
+    return 0;
+}
+
+static long pb2_insert_batch(unsigned long arg, struct process_node *curr) {
+    struct pb2_batch batch;
+    struct pb2_chunk *chunk;
+    int n, ret;
+
+    pr_debug("PB2_INSERT_BATCH invoked by process %d\n", curr->pid);
+    if (copy_from_user(&batch, (struct pb2_batch *)arg, sizeof(struct pb2_batch)) != 0) {
+        pr_debug("Error: could not copy batch from user\n");
+        return -EINVAL;
+    }
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not set the capacity of the priority queue\n", curr->pid);
+        return -EACCES;
+    } else if (has_pending(curr)) {
+        pr_debug("Error: thread %d is supposed to enter priority, not a batch\n", current->pid);
+        return -EACCES;
+    }
+    if (batch.count < 0) {
+        pr_debug("Error: Batch count must be non-negative\n");
+        return -EINVAL;
+    }
+    // Only the pairs that fit in the queue are copied and inserted
+    n = 0;
+    if (batch.count > 0) {
+        n = wait_space(curr, batch.count, curr->mode & PB2_MODE_BLOCK_WRITE, MAX_SCHEDULE_TIMEOUT);
+        if (n < 0) {
+            return n;
+        }
+    }
+    if (n > 0) {
+        chunk = alloc_chunk(n);
+        if (chunk == NULL) {
+            release_slots(curr->proc_pq, n);
+            return -ENOMEM;
+        }
+        ret = copy_chunk(curr->proc_pq, chunk, batch.pairs);
+        if (ret < 0) {
+            kvfree(chunk);
+            release_slots(curr->proc_pq, n);
+            return ret;
+        }
+        if (curr->proc_pq->subs != NULL) {
+            ret = relaxed_push(curr->proc_pq, chunk->pairs, n);
+            kvfree(chunk);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            // Merging grows the heap once for the whole batch
+            stage_chunk(curr->proc_pq, chunk);
+            merge_staged(curr->proc_pq);
+        }
+        pr_debug("%d of %d elements have been inserted into the priority queue for process %d\n", n, batch.count, curr->pid);
+    }
+    batch.accepted = n;
+    if (copy_to_user(&((struct pb2_batch *)arg)->accepted, &batch.accepted, sizeof(int32_t))) {
+        pr_debug("Error: could not copy accepted count to user\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static long pb2_insert_timed(unsigned long arg, struct process_node *curr) {
+    struct pb2_timed_insert req;
+    int ret;
+
+    pr_debug("PB2_INSERT_TIMED invoked by process %d\n", curr->pid);
+    if (copy_from_user(&req, (struct pb2_timed_insert *)arg, sizeof(struct pb2_timed_insert)) != 0) {
+        pr_debug("Error: could not copy timed insert from user\n");
+        return -EINVAL;
+    }
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not set the capacity of the priority queue\n", curr->pid);
+        return -EACCES;
+    } else if (has_pending(curr)) {
+        pr_debug("Error: thread %d is supposed to enter priority, not an element\n", current->pid);
+        return -EACCES;
+    }
+    if (req.priority < 1 || req.priority > pq_max_priority(curr->proc_pq) || req.timeout_ms < 0) {
+        pr_debug("Error: Priority must be between 1 and %d and timeout non-negative\n", pq_max_priority(curr->proc_pq));
+        return -EINVAL;
+    }
+    ret = wait_space(curr, 1, 1, msecs_to_jiffies(req.timeout_ms));
+    if (ret < 0) {
+        return ret;
+    }
+    return insert(curr->proc_pq, req.val, req.priority);
+}
+
+// Serves both PB2_GET_INFO and PB2_GET_INFO_EXT, struct obj_info is a prefix of struct obj_info_ext
+static long pb2_get_info(unsigned long arg, struct process_node *curr, int ext) {
+    struct obj_info_ext info;
+    pr_debug("%s invoked by process %d\n", ext ? "PB2_GET_INFO_EXT" : "PB2_GET_INFO", curr->pid);
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not set the capacity of the priority queue\n", curr->pid);
+        return -EACCES;
+    }
+    info.prio_que_size = pq_size(curr->proc_pq);
+    info.capacity = curr->proc_pq->capacity;
+    info.allocated = pq_allocated(curr->proc_pq);
+    info.footprint = pq_footprint(curr->proc_pq);
+    if (copy_to_user((void *)arg, &info, ext ? sizeof(struct obj_info_ext) : sizeof(struct obj_info))) {
+        pr_debug("Error: could not copy info to user\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static long pb2_get_min(unsigned long arg, struct process_node *curr) {
+    int min_val, ret;
+    struct element min_elem;
+    pr_debug("PB2_GET_MIN invoked by process %d\n", curr->pid);
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not yet written anything to the proc file\n", curr->pid);
+        return -EACCES;
+    }
+    ret = wait_nonempty(curr);
+    if (ret < 0) {
+        return ret;
+    }
+    extract_min(curr->proc_pq, &min_elem);
+    min_val = min_elem.val;
+    if (copy_to_user((int32_t *)arg, &min_val, sizeof(int32_t))) {
+        pr_debug("Error: could not copy min value to user\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static long pb2_get_max(unsigned long arg, struct process_node *curr) {
+    int max_val, ret;
+    struct element max_elem;
+    pr_debug("PB2_GET_MAX invoked by process %d\n", curr->pid);
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not yet written anything to the proc file\n", curr->pid);
+        return -EACCES;
+    }
+    ret = wait_nonempty(curr);
+    if (ret < 0) {
+        return ret;
+    }
+    extract_max(curr->proc_pq, &max_elem);
+    max_val = max_elem.val;
+    if (copy_to_user((int32_t *)arg, &max_val, sizeof(int32_t))) {
+        pr_debug("Error: could not copy max value to user\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// Extract up to drain.count elements in priority order, smallest first or largest first
+static long pb2_get_n(unsigned long arg, struct process_node *curr, int largest) {
+    struct pb2_drain drain;
+    struct element elem;
+    struct pb2_record *record;
+    void *out;
+    size_t elem_size;
+    int i, n, ret = 0;
+
+    pr_debug("%s invoked by process %d\n", largest ? "PB2_GET_MAX_N" : "PB2_GET_MIN_N", curr->pid);
+    if (copy_from_user(&drain, (struct pb2_drain *)arg, sizeof(struct pb2_drain)) != 0) {
+        pr_debug("Error: could not copy drain request from user\n");
+        return -EINVAL;
+    }
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not yet written anything to the proc file\n", curr->pid);
+        return -EACCES;
+    }
+    if (drain.count < 1 || (drain.flags & ~PB2_DRAIN_RECORDS) != 0) {
+        pr_debug("Error: invalid drain count or flags\n");
+        return -EINVAL;
+    }
+    ret = wait_nonempty(curr);
+    if (ret < 0) {
+        return ret;
+    }
+    n = min(drain.count, pq_size(curr->proc_pq));
+    elem_size = (drain.flags & PB2_DRAIN_RECORDS) ? sizeof(struct pb2_record) : sizeof(int32_t);
+    out = kvmalloc_array(n, elem_size, GFP_KERNEL);
+    if (out == NULL) {
+        printk(KERN_ALERT "Error: could not allocate memory for drain buffer\n");
+        return -ENOMEM;
+    }
+    for (i = 0; i < n; i++) {
+        // Only a relaxed queue can come up short, its count includes inserts still in progress
+        ret = largest ? extract_max(curr->proc_pq, &elem) : extract_min(curr->proc_pq, &elem);
+        if (ret < 0) {
+            n = i;
+            ret = 0;
+            break;
+        }
+        if (drain.flags & PB2_DRAIN_RECORDS) {
+            record = (struct pb2_record *)out + i;
+            record->val = elem.val;
+            record->priority = elem.priority;
+            record->insert_time = elem.insert_time;
+        } else {
+            ((int32_t *)out)[i] = elem.val;
+        }
+    }
+    // The elements have already left the queue, a failed copy loses them like a failed PB2_GET_MIN
+    if (copy_to_user(drain.buf, out, n * elem_size)) {
+        pr_debug("Error: could not copy drained elements to user\n");
+        ret = -EINVAL;
+    } else if (copy_to_user(&((struct pb2_drain *)arg)->extracted, &n, sizeof(int32_t))) {
+        pr_debug("Error: could not copy extracted count to user\n");
+        ret = -EINVAL;
+    }
+    kvfree(out);
+    return ret;
+}
+
+static long pb2_setup_ring(unsigned long arg, struct process_node *curr) {
+    struct pb2_ring_params params;
+
+    pr_debug("PB2_SETUP_RING invoked by process %d\n", curr->pid);
+    if (copy_from_user(&params, (struct pb2_ring_params *)arg, sizeof(struct pb2_ring_params)) != 0) {
+        pr_debug("Error: could not copy ring parameters from user\n");
+        return -EINVAL;
+    }
+    // The ring may already be mapped, so it cannot be replaced
+    if (curr->ring != NULL) {
+        pr_debug("Error: process %d has already set up a ring on this file\n", curr->pid);
+        return -EBUSY;
+    }
+    if (params.cq_entries == 0) {
+        params.cq_entries = 2 * params.sq_entries;
+    }
+    if (params.sq_entries < 1 || params.sq_entries > PB2_RING_MAX_ENTRIES || params.cq_entries > 2 * PB2_RING_MAX_ENTRIES) {
+        pr_debug("Error: Ring sizes must be between 1 and %d\n", PB2_RING_MAX_ENTRIES);
+        return -EINVAL;
+    }
+    params.sq_entries = roundup_pow_of_two(params.sq_entries);
+    params.cq_entries = roundup_pow_of_two(params.cq_entries);
+    curr->ring = create_ring(&params);
+    if (curr->ring == NULL) {
+        printk(KERN_ALERT "Error: could not allocate memory for ring\n");
+        return -ENOMEM;
+    }
+    if (copy_to_user((struct pb2_ring_params *)arg, &params, sizeof(struct pb2_ring_params))) {
+        pr_debug("Error: could not copy ring parameters to user\n");
+        return -EINVAL;
+    }
+    return 0;
+}
 
-    pid = current->pid;
-    curr = find_process(pid);
-    if (curr == NULL) {
-        printk(KERN_ALERT "Error: process %d does not have the proc file open\n", pid);
-        mutex_unlock(&mutex);
+// Doorbell: consume every submitted sqe that has room for its cqe, returns the number consumed
+static long pb2_ring_enter(struct process_node *curr) {
+    struct pb2_ring *ring = curr->ring;
+    uint32_t sq_tail, cq_head, pending, space, i;
+
+    pr_debug("PB2_RING_ENTER invoked by process %d\n", curr->pid);
+    if (ring == NULL) {
+        pr_debug("Error: process %d has not set up a ring on this file\n", curr->pid);
+        return -EACCES;
+    }
+    // Pairs with the release stores of user space, the entries are visible once the index is
+    sq_tail = smp_load_acquire(&ring->hdr->sq_tail);
+    cq_head = smp_load_acquire(&ring->hdr->cq_head);
+    pending = sq_tail - ring->sq_head;
+    space = ring->cq_entries - (ring->cq_tail - cq_head);
+    if (pending > ring->sq_entries || space > ring->cq_entries) {
+        pr_debug("Error: ring indices of process %d are corrupted\n", curr->pid);
+        return -EINVAL;
+    }
+    pending = min(pending, space);
+    for (i = 0; i < pending; i++) {
+        run_sqe(curr->proc_pq, &ring->sqes[ring->sq_head & (ring->sq_entries - 1)],
+                &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)]);
+        ring->sq_head++;
+        ring->cq_tail++;
+    }
+    smp_store_release(&ring->hdr->cq_tail, ring->cq_tail);
+    smp_store_release(&ring->hdr->sq_head, ring->sq_head);
+    return pending;
+}
+
+static long pb2_set_mode(unsigned long arg, struct process_node *curr) {
+    int32_t mode;
+
+    pr_debug("PB2_SET_MODE invoked by process %d\n", curr->pid);
+    if (copy_from_user(&mode, (int32_t *)arg, sizeof(int32_t)) != 0) {
+        pr_debug("Error: could not copy mode from user\n");
+        return -EINVAL;
+    }
+    if (mode & ~(PB2_MODE_BLOCK_READ | PB2_MODE_BLOCK_WRITE | PB2_MODE_COMBINE)) {
+        pr_debug("Error: invalid mode %#x\n", mode);
+        return -EINVAL;
+    }
+    if ((mode & PB2_MODE_COMBINE) && enable_combining(curr->proc_pq) < 0) {
+        return -ENOMEM;
+    }
+    curr->mode = mode;
+    return 0;
+}
+
+static struct priority_queue *find_named_pq(const char *name) {
+    struct priority_queue *pq;
+    list_for_each_entry(pq, &named_queues, list) {
+        if (strcmp(pq->name, name) == 0) {
+            return pq;
+        }
+    }
+    return NULL;
+}
+
+// Switch the file from its own queue to a named queue, creating the queue if asked to.
+// The named queue lives until the last file attached to it is closed.
+static long pb2_attach(unsigned long arg, struct process_node *curr) {
+    struct pb2_attach req;
+    struct priority_queue *pq;
+    long ret = 0;
+
+    pr_debug("PB2_ATTACH invoked by process %d\n", curr->pid);
+    if (copy_from_user(&req, (struct pb2_attach *)arg, sizeof(struct pb2_attach)) != 0) {
+        pr_debug("Error: could not copy attach request from user\n");
+        return -EINVAL;
+    }
+    req.name[PB2_NAME_LEN - 1] = '\0';
+    if (req.name[0] == '\0' || (req.flags & ~(PB2_ATTACH_CREATE | PB2_ATTACH_EXCL | PB2_ATTACH_RELAXED)) != 0) {
+        pr_debug("Error: invalid queue name or attach flags\n");
+        return -EINVAL;
+    }
+    // Only a file that has not used its own queue yet can attach, and only once
+    if (curr->state != PROC_FILE_OPEN || curr->proc_pq != curr->own_pq) {
+        pr_debug("Error: process %d has already set up a queue on this file\n", curr->pid);
+        return -EBUSY;
+    }
+
+    mutex_lock(&named_lock);
+    pq = find_named_pq(req.name);
+    if (pq != NULL) {
+        if (req.flags & PB2_ATTACH_EXCL) {
+            pr_debug("Error: named queue %s already exists\n", req.name);
+            ret = -EEXIST;
+        } else {
+            kref_get(&pq->ref);
+        }
+    } else if (!(req.flags & PB2_ATTACH_CREATE)) {
+        pr_debug("Error: named queue %s does not exist\n", req.name);
+        ret = -ENOENT;
+    } else if (!pq_valid_capacity(req.capacity)) {
+        pr_debug("Error: Capacity must be between 1 and %d, or %d for an unbounded queue\n", PQ_MAX_CAPACITY, PQ_UNBOUNDED);
+        ret = -EINVAL;
+    } else if ((req.flags & PB2_ATTACH_RELAXED) && curr->own_pq->backend != PB2_BACKEND_MINMAX) {
+        pr_debug("Error: relaxed queues only use the min-max heap backend\n");
+        ret = -EINVAL;
+    } else {
+        pq = create_pq();
+        if (pq != NULL) {
+            // The queue is created with the backend chosen for the file's own queue
+            pq->backend = curr->own_pq->backend;
+        }
+        // Only named queues have counters of their own, they are the ones listed in the stats file
+        if (pq != NULL) {
+            pq->stats = alloc_percpu(struct pq_counters);
+        }
+        if (pq == NULL || pq->stats == NULL || reset_pq(pq, req.capacity) < 0 || ((req.flags & PB2_ATTACH_RELAXED) && create_subs(pq) < 0)) {
+            printk(KERN_ALERT "Error: named priority queue initialization failed\n");
+            delete_pq(pq);
+            ret = -ENOMEM;
+        } else {
+            strscpy(pq->name, req.name, PB2_NAME_LEN);
+            list_add(&pq->list, &named_queues);
+            pr_debug("Named %s priority queue %s with capacity %d has been created\n", pq->subs ? "relaxed" : "strict", pq->name, req.capacity);
+        }
+    }
+    mutex_unlock(&named_lock);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // A named queue without slots leaves the file on the locked path
+    if (curr->mode & PB2_MODE_COMBINE) {
+        enable_combining(pq);
+    }
+    // The caller holds the lock of own_pq, see lock_pq(). Pollers of the file follow it
+    // to the named queue, they stay registered on pollq.
+    if (curr->polled) {
+        hook_poll(curr, curr->own_pq, 0);
+        hook_poll(curr, pq, 1);
+    }
+    WRITE_ONCE(curr->proc_pq, pq);
+    curr->state = PROC_READ_VALUE;
+    wake_up_interruptible(&curr->pollq);
+    pr_debug("Process %d has attached to named priority queue %s\n", curr->pid, pq->name);
+    return 0;
+}
+
+// PB2_INSERT_BATCH and PB2_INSERT_TIMED on a queue with free space, without its lock:
+// staged for a strict queue, straight into a sub-heap for a relaxed one.
+// Returns PQ_NEED_LOCK for everything else, which then takes the locked path.
+static long pb2_insert_staged(unsigned int cmd, unsigned long arg, struct process_node *curr) {
+    struct priority_queue *pq = READ_ONCE(curr->proc_pq);
+    struct pb2_batch batch;
+    struct pb2_timed_insert req;
+    struct pb2_chunk *chunk;
+    int n, ret;
+
+    // Producers blocked in wait_space() are served first, newcomers queue behind them
+    if (READ_ONCE(curr->state) != PROC_READ_VALUE || has_pending(curr) || READ_ONCE(pq->space_waiters) > 0) {
+        return PQ_NEED_LOCK;
+    }
+    if (cmd == PB2_INSERT_BATCH) {
+        if (copy_from_user(&batch, (struct pb2_batch *)arg, sizeof(struct pb2_batch)) != 0) {
+            pr_debug("Error: could not copy batch from user\n");
+            return -EINVAL;
+        }
+        n = batch.count > 0 ? reserve_slots(pq, batch.count) : 0;
+        if (n == 0) {
+            return PQ_NEED_LOCK;
+        }
+        chunk = alloc_chunk(n);
+        if (chunk == NULL) {
+            release_slots(pq, n);
+            return -ENOMEM;
+        }
+        ret = copy_chunk(pq, chunk, batch.pairs);
+        if (ret < 0) {
+            kvfree(chunk);
+            release_slots(pq, n);
+            return ret;
+        }
+        if (pq->subs != NULL) {
+            ret = relaxed_push(pq, chunk->pairs, n);
+            kvfree(chunk);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            stage_chunk(pq, chunk);
+        }
+        if (copy_to_user(&((struct pb2_batch *)arg)->accepted, &n, sizeof(int32_t))) {
+            pr_debug("Error: could not copy accepted count to user\n");
+            return -EINVAL;
+        }
+    } else {
+        if (copy_from_user(&req, (struct pb2_timed_insert *)arg, sizeof(struct pb2_timed_insert)) != 0) {
+            pr_debug("Error: could not copy timed insert from user\n");
+            return -EINVAL;
+        }
+        if (req.priority < 1 || req.priority > pq_max_priority(pq) || req.timeout_ms < 0 || reserve_slots(pq, 1) == 0) {
+            return PQ_NEED_LOCK;
+        }
+        if (pq->subs != NULL) {
+            struct pb2_pair pair = {req.val, req.priority};
+            return relaxed_push(pq, &pair, 1);
+        }
+        chunk = alloc_chunk(1);
+        if (chunk == NULL) {
+            release_slots(pq, 1);
+            return -ENOMEM;
+        }
+        chunk->pairs[0].val = req.val;
+        chunk->pairs[0].priority = req.priority;
+        stage_chunk(pq, chunk);
+    }
+    return 0;
+}
+
+// PB2_GET_MIN and PB2_GET_MAX on a relaxed queue, without its lock.
+// Returns PQ_NEED_LOCK for other queues, which then take the locked path.
+static long pb2_get_relaxed(unsigned long arg, struct process_node *curr, int largest) {
+    struct priority_queue *pq = READ_ONCE(curr->proc_pq);
+    struct element elem;
+    int ret;
+
+    if (pq->subs == NULL) {
+        return PQ_NEED_LOCK;
+    }
+    pr_debug("%s invoked by process %d\n", largest ? "PB2_GET_MAX" : "PB2_GET_MIN", curr->pid);
+    ret = relaxed_extract(pq, &elem, largest);
+    if (ret < 0 && (READ_ONCE(curr->mode) & PB2_MODE_BLOCK_READ)) {
+        if (curr->file->f_flags & O_NONBLOCK) {
+            stat_add(pq, STAT_EMPTY, 1);
+            return -EAGAIN;
+        }
+        // Inserters wake one exclusive waiter per element once it can be extracted. The wait
+        // condition must not sleep, so the extraction is retried after every wakeup instead.
+        // It looks at the sub-heaps rather than count, whose slots reserved by inserts in
+        // flight would keep the waiter retrying until those elements are pushed.
+        do {
+            ret = wait_event_interruptible_exclusive(pq->readq, pq_readable(pq));
+            if (ret == 0) {
+                ret = relaxed_extract(pq, &elem, largest);
+            }
+        } while (ret == -EACCES);
+    }
+    if (ret == -EACCES) {
+        stat_add(pq, STAT_EMPTY, 1);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    if (copy_to_user((int32_t *)arg, &elem.val, sizeof(int32_t))) {
+        pr_debug("Error: could not copy %s value to user\n", largest ? "max" : "min");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// PB2_INSERT_PRIO, PB2_GET_MIN and PB2_GET_MAX of a PB2_MODE_COMBINE file through combine(),
+// when they would fail rather than block on a full or empty queue. Returns PQ_NEED_LOCK
+// for everything else, including invalid requests, which then take the locked path.
+static long pb2_combined(unsigned int cmd, unsigned long arg, struct process_node *curr) {
+    struct priority_queue *pq;
+    struct pb2_sqe sqe = {0};
+    struct pb2_cqe cqe;
+    int mode = READ_ONCE(curr->mode);
+    void *entry = NULL;
+    int32_t prio;
+    int ret;
+
+    if (!(mode & PB2_MODE_COMBINE) || READ_ONCE(curr->state) != PROC_READ_VALUE) {
+        return PQ_NEED_LOCK;
+    }
+    pq = READ_ONCE(curr->proc_pq);
+    if (cmd == PB2_INSERT_PRIO) {
+        if (mode & PB2_MODE_BLOCK_WRITE) {
+            return PQ_NEED_LOCK;
+        }
+        if (copy_from_user(&prio, (int32_t *)arg, sizeof(int32_t)) != 0) {
+            pr_debug("Error: could not copy priority from user\n");
+            return -EINVAL;
+        }
+        if (prio < 1 || prio > pq_max_priority(pq) || !has_pending(curr)) {
+            return PQ_NEED_LOCK;
+        }
+        // Claimed so that a PB2_SET_CAPACITY meanwhile cannot drop it under the request
+        entry = xa_erase(&curr->pending, current->pid);
+        if (entry == NULL) {
+            return PQ_NEED_LOCK;
+        }
+        sqe.opcode = PB2_OP_INSERT;
+        sqe.val = (u32)xa_to_value(entry);
+        sqe.priority = prio;
+    } else {
+        if (mode & PB2_MODE_BLOCK_READ) {
+            return PQ_NEED_LOCK;
+        }
+        sqe.opcode = cmd == PB2_GET_MAX ? PB2_OP_GET_MAX : PB2_OP_GET_MIN;
+    }
+
+    ret = combine(pq, &sqe, &cqe);
+    if (ret == 0) {
+        ret = cqe.res;
+    }
+    if (entry != NULL && ret != 0) {
+        // The thread still owes the priority of its value, as after a failed locked insert
+        if (xa_err(xa_store(&curr->pending, current->pid, entry, GFP_KERNEL))) {
+            printk(KERN_ALERT "Error: could not allocate memory for the pending value\n");
+            return -ENOMEM;
+        }
+    }
+    if (ret != 0 || cmd == PB2_INSERT_PRIO) {
+        return ret;
+    }
+    if (copy_to_user((int32_t *)arg, &cqe.val, sizeof(int32_t))) {
+        pr_debug("Error: could not copy %s value to user\n", cmd == PB2_GET_MAX ? "max" : "min");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// Load a whole array in one call: the pairs get consecutive insert times in array order
+// and are appended to the heap array, which is then rebuilt with heapify(). A load that
+// is small next to the queue, or goes into a pairing heap or bucket queue where inserting
+// is O(1) anyway, is cheaper as ordinary inserts.
+static long pb2_bulk_load(unsigned long arg, struct process_node *curr) {
+    struct priority_queue *pq = curr->proc_pq;
+    struct pb2_batch batch;
+    struct pb2_chunk *chunk;
+    int i, n, first_time, ret = 0;
+
+    pr_debug("PB2_BULK_LOAD invoked by process %d\n", curr->pid);
+    if (copy_from_user(&batch, (struct pb2_batch *)arg, sizeof(struct pb2_batch)) != 0) {
+        pr_debug("Error: could not copy batch from user\n");
+        return -EINVAL;
+    }
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not set the capacity of the priority queue\n", curr->pid);
+        return -EACCES;
+    } else if (has_pending(curr)) {
+        pr_debug("Error: thread %d is supposed to enter priority, not a batch\n", current->pid);
+        return -EACCES;
+    }
+    if (batch.count < 0) {
+        pr_debug("Error: Batch count must be non-negative\n");
+        return -EINVAL;
+    }
+    // Only the pairs that fit in the queue are loaded, after the producers blocked in wait_space()
+    n = pq->space_waiters > 0 ? 0 : reserve_slots(pq, batch.count);
+    if (n > 0) {
+        chunk = alloc_chunk(n);
+        if (chunk == NULL) {
+            release_slots(pq, n);
+            return -ENOMEM;
+        }
+        ret = copy_chunk(pq, chunk, batch.pairs);
+        if (ret < 0) {
+            release_slots(pq, n);
+        } else if (pq->subs != NULL) {
+            ret = relaxed_push(pq, chunk->pairs, n);
+        } else if (reserve_pq(pq, pq->size + n) < 0) {
+            release_slots(pq, n);
+            ret = -ENOMEM;
+        } else {
+            first_time = take_times(pq, n);
+            if (n < pq->size || pq->backend == PB2_BACKEND_PAIRING || pq->backend == PB2_BACKEND_BUCKET) {
+                for (i = 0; i < n; i++) {
+                    heap_push(pq, chunk->pairs[i].val, chunk->pairs[i].priority, first_time + i, -1);
+                }
+            } else {
+                for (i = 0; i < n; i++) {
+                    if (pq->backend == PB2_BACKEND_DARY) {
+                        pq->keys[pq->size + i] = pack_key(chunk->pairs[i].priority, first_time + i);
+                        pq->vals[pq->size + i] = chunk->pairs[i].val;
+                    } else {
+                        pq->heap[pq->size + i].val = chunk->pairs[i].val;
+                        pq->heap[pq->size + i].priority = chunk->pairs[i].priority;
+                        pq->heap[pq->size + i].insert_time = first_time + i;
+                        pq->heap[pq->size + i].handle = -1;
+                    }
+                }
+                pq->size += n;
+                stat_add(pq, STAT_INSERTS, n);
+                heapify(pq);
+            }
+        }
+        kvfree(chunk);
+        if (ret < 0) {
+            return ret;
+        }
+        pr_debug("%d of %d elements have been loaded into the priority queue for process %d\n", n, batch.count, curr->pid);
+    }
+    if (copy_to_user(&((struct pb2_batch *)arg)->accepted, &n, sizeof(int32_t))) {
+        pr_debug("Error: could not copy accepted count to user\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// Handles need a min-max heap, the other backends do not track element positions
+static int check_handles(struct process_node *curr) {
+    if (curr->state == PROC_FILE_OPEN) {
+        pr_debug("Error: process %d has not set the capacity of the priority queue\n", curr->pid);
+        return -EACCES;
+    }
+    if (curr->proc_pq->backend != PB2_BACKEND_MINMAX || curr->proc_pq->subs != NULL) {
+        pr_debug("Error: the priority queue of process %d does not support handles\n", curr->pid);
+        return -EOPNOTSUPP;
+    }
+    return 0;
+}
+
+static long pb2_insert_handle(unsigned long arg, struct process_node *curr) {
+    struct pb2_handle_insert req;
+    struct priority_queue *pq = curr->proc_pq;
+    int h, ret;
+
+    pr_debug("PB2_INSERT_HANDLE invoked by process %d\n", curr->pid);
+    if (copy_from_user(&req, (struct pb2_handle_insert *)arg, sizeof(struct pb2_handle_insert)) != 0) {
+        pr_debug("Error: could not copy insert request from user\n");
+        return -EINVAL;
+    }
+    ret = check_handles(curr);
+    if (ret < 0) {
+        return ret;
+    }
+    if (has_pending(curr)) {
+        pr_debug("Error: thread %d is supposed to enter priority, not an element\n", current->pid);
         return -EACCES;
     }
+    if (req.priority < 1) {
+        pr_debug("Error: Priority must be a positive integer\n");
+        return -EINVAL;
+    }
+    ret = wait_space(curr, 1, curr->mode & PB2_MODE_BLOCK_WRITE, MAX_SCHEDULE_TIMEOUT);
+    if (ret < 0) {
+        return ret;
+    }
+    if (reserve_pq(pq, pq->size + 1) < 0 || (h = alloc_handle(pq)) < 0) {
+        release_slots(pq, 1);
+        return -ENOMEM;
+    }
+    heap_push(pq, req.val, req.priority, take_times(pq, 1), h);
+    req.handle = (int64_t)pq->handles[h].gen << 32 | h;
+    if (copy_to_user(&((struct pb2_handle_insert *)arg)->handle, &req.handle, sizeof(int64_t))) {
+        pr_debug("Error: could not copy handle to user\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// Change the priority of an element in O(log n), its insert time still breaks ties
+static long pb2_update_prio(unsigned long arg, struct process_node *curr) {
+    struct pb2_update req;
+    struct priority_queue *pq;
+    int i, ret;
+
+    pr_debug("PB2_UPDATE_PRIO invoked by process %d\n", curr->pid);
+    if (copy_from_user(&req, (struct pb2_update *)arg, sizeof(struct pb2_update)) != 0) {
+        pr_debug("Error: could not copy update request from user\n");
+        return -EINVAL;
+    }
+    ret = check_handles(curr);
+    if (ret < 0) {
+        return ret;
+    }
+    if (req.priority < 1) {
+        pr_debug("Error: Priority must be a positive integer\n");
+        return -EINVAL;
+    }
+    i = lookup_handle(curr->proc_pq, req.handle);
+    if (i < 0) {
+        pr_debug("Error: handle %lld is not in the priority queue\n", req.handle);
+        return i;
+    }
+    pq = curr->proc_pq;
+    pq->heap[i].priority = req.priority;
+    minmax_restore(pq->heap, pq->size, pq->handles, i);
+    return 0;
+}
+
+// Remove an element in O(log n), its handle becomes invalid like after an extraction
+static long pb2_delete(unsigned long arg, struct process_node *curr) {
+    int64_t handle;
+    int i, ret;
+
+    pr_debug("PB2_DELETE invoked by process %d\n", curr->pid);
+    if (copy_from_user(&handle, (int64_t *)arg, sizeof(int64_t)) != 0) {
+        pr_debug("Error: could not copy handle from user\n");
+        return -EINVAL;
+    }
+    ret = check_handles(curr);
+    if (ret < 0) {
+        return ret;
+    }
+    i = lookup_handle(curr->proc_pq, handle);
+    if (i < 0) {
+        pr_debug("Error: handle %lld is not in the priority queue\n", handle);
+        return i;
+    }
+    remove_at(curr->proc_pq, i);
+    return 0;
+}
+
+// Choose the heap implementation of the file's queue, or of a queue it creates with PB2_ATTACH
+static long pb2_set_backend(unsigned long arg, struct process_node *curr) {
+    int32_t backend;
+
+    pr_debug("PB2_SET_BACKEND invoked by process %d\n", curr->pid);
+    if (copy_from_user(&backend, (int32_t *)arg, sizeof(int32_t)) != 0) {
+        pr_debug("Error: could not copy backend from user\n");
+        return -EINVAL;
+    }
+    if (backend < PB2_BACKEND_MINMAX || backend > PB2_BACKEND_BUCKET) {
+        pr_debug("Error: invalid backend %d\n", backend);
+        return -EINVAL;
+    }
+    if (curr->state != PROC_FILE_OPEN) {
+        pr_debug("Error: process %d must choose the backend before setting up the queue\n", curr->pid);
+        return -EBUSY;
+    }
+    curr->own_pq->backend = backend;
+    return 0;
+}
+
+// Move every element of the queue of another open of the proc file, given by its file
+// descriptor, into this file's queue and leave that queue empty. Handles of the moved
+// elements become stale.
+static long pb2_meld(unsigned long arg, struct process_node *curr) {
+    int32_t fd;
+    struct file *file;
+    struct process_node *from;
+    struct priority_queue *dst, *src;
+    int n;
+    long ret = 0;
+
+    pr_debug("PB2_MELD invoked by process %d\n", curr->pid);
+    if (copy_from_user(&fd, (int32_t *)arg, sizeof(int32_t)) != 0) {
+        pr_debug("Error: could not copy file descriptor from user\n");
+        return -EINVAL;
+    }
+    file = fget(fd);
+    if (file == NULL) {
+        return -EBADF;
+    }
+    // The reference keeps the other file, and so its process node, from being released
+    if (PDE(file_inode(file)) != proc_file) {
+        pr_debug("Error: file descriptor %d is not an open of the proc file\n", fd);
+        fput(file);
+        return -EINVAL;
+    }
+    from = file->private_data;
+    lock_two(curr, from, &dst, &src);
+
+    if (curr->state == PROC_FILE_OPEN || from->state == PROC_FILE_OPEN) {
+        pr_debug("Error: both priority queues must have their capacity set before melding\n");
+        ret = -EACCES;
+    } else if (dst == src) {
+        pr_debug("Error: cannot meld a priority queue into itself\n");
+        ret = -EINVAL;
+    } else if (dst->subs != NULL || src->subs != NULL) {
+        pr_debug("Error: relaxed priority queues cannot be melded\n");
+        ret = -EOPNOTSUPP;
+    } else if (src->size > 0 && dst->backend == PB2_BACKEND_BUCKET && top_priority(src) > PQ_BUCKET_PRIOS) {
+        pr_debug("Error: a bucket queue only takes priorities up to %d\n", PQ_BUCKET_PRIOS);
+        ret = -EINVAL;
+    } else if (src->size > 0) {
+        // All or nothing, unlike a batch, and after the producers blocked in wait_space()
+        n = dst->space_waiters > 0 ? 0 : reserve_slots(dst, src->size);
+        if (n < src->size) {
+            release_slots(dst, n);
+            pr_debug("Error: priority queue is too full to take %d elements\n", src->size);
+            stat_add(dst, STAT_FULL, 1);
+            ret = -EACCES;
+        } else if (meld(dst, src) < 0) {
+            release_slots(dst, n);
+            ret = -ENOMEM;
+        } else {
+            pr_debug("%d elements have been melded into the priority queue for process %d\n", n, curr->pid);
+        }
+    }
+    wake_waiters(src);
+    wake_waiters(dst);
+    mutex_unlock(&src->lock);
+    if (dst != src) {
+        mutex_unlock(&dst->lock);
+    }
+    fput(file);
+    return ret;
+}
+
+static long do_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    int ret;
+    struct process_node *curr = filep->private_data;
+    struct priority_queue *pq;
+
+    // Inserts, and extractions from relaxed queues, are served without taking the queue lock,
+    // single inserts and extractions of PB2_MODE_COMBINE files mostly so, see combine()
+    if (cmd == PB2_INSERT_BATCH || cmd == PB2_INSERT_TIMED) {
+        ret = pb2_insert_staged(cmd, arg, curr);
+        if (ret != PQ_NEED_LOCK) {
+            return ret;
+        }
+    } else if (cmd == PB2_GET_MIN || cmd == PB2_GET_MAX) {
+        ret = pb2_get_relaxed(arg, curr, cmd == PB2_GET_MAX);
+        if (ret == PQ_NEED_LOCK) {
+            ret = pb2_combined(cmd, arg, curr);
+        }
+        if (ret != PQ_NEED_LOCK) {
+            return ret;
+        }
+    } else if (cmd == PB2_INSERT_PRIO) {
+        ret = pb2_combined(cmd, arg, curr);
+        if (ret != PQ_NEED_LOCK) {
+            return ret;
+        }
+    } else if (cmd == PB2_MELD) {
+        // Takes the locks of both queues itself
+        return pb2_meld(arg, curr);
+    }
+
+    pq = lock_pq(curr);
 
     if (cmd == PB2_SET_CAPACITY) {
         ret = pb2_set_capacity(arg, curr);
@@ -493,44 +3072,212 @@ static long proc_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
     } else if (cmd == PB2_INSERT_PRIO) {
         ret = pb2_insert_prio(arg, curr);
     } else if (cmd == PB2_GET_INFO) {
-        ret = pb2_get_info(arg, curr);
+        ret = pb2_get_info(arg, curr, 0);
     } else if (cmd == PB2_GET_MIN) {
         ret = pb2_get_min(arg, curr);
     } else if (cmd == PB2_GET_MAX) {
         ret = pb2_get_max(arg, curr);
+    } else if (cmd == PB2_INSERT_BATCH) {
+        ret = pb2_insert_batch(arg, curr);
+    } else if (cmd == PB2_GET_MIN_N) {
+        ret = pb2_get_n(arg, curr, 0);
+    } else if (cmd == PB2_GET_MAX_N) {
+        ret = pb2_get_n(arg, curr, 1);
+    } else if (cmd == PB2_GET_INFO_EXT) {
+        ret = pb2_get_info(arg, curr, 1);
+    } else if (cmd == PB2_SETUP_RING) {
+        ret = pb2_setup_ring(arg, curr);
+    } else if (cmd == PB2_RING_ENTER) {
+        ret = pb2_ring_enter(curr);
+    } else if (cmd == PB2_SET_MODE) {
+        ret = pb2_set_mode(arg, curr);
+    } else if (cmd == PB2_INSERT_TIMED) {
+        ret = pb2_insert_timed(arg, curr);
+    } else if (cmd == PB2_ATTACH) {
+        ret = pb2_attach(arg, curr);
+    } else if (cmd == PB2_SET_BACKEND) {
+        ret = pb2_set_backend(arg, curr);
+    } else if (cmd == PB2_INSERT_HANDLE) {
+        ret = pb2_insert_handle(arg, curr);
+    } else if (cmd == PB2_UPDATE_PRIO) {
+        ret = pb2_update_prio(arg, curr);
+    } else if (cmd == PB2_DELETE) {
+        ret = pb2_delete(arg, curr);
+    } else if (cmd == PB2_BULK_LOAD) {
+        ret = pb2_bulk_load(arg, curr);
     } else {
-        printk(KERN_ALERT "Error: invalid ioctl command\n");
+        pr_debug("Error: invalid ioctl command\n");
         ret = -EINVAL;
     }
 
-    print_pq(curr->proc_pq);
-    mutex_unlock(&mutex);
+    wake_waiters(pq);
+    print_pq(pq);
+    mutex_unlock(&pq->lock);
+    return ret;
+}
+
+// Time every ioctl into the latency histogram of its command, including any time spent blocked
+static long proc_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    u64 start = ktime_get_ns(), ns;
+    unsigned int nr = _IOC_NR(cmd) - PB2_CMD_FIRST;
+    long ret = do_ioctl(filep, cmd, arg);
+
+    if (_IOC_TYPE(cmd) == 0x10 && nr < PB2_NR_CMDS) {
+        ns = ktime_get_ns() - start;
+        this_cpu_inc(latency.hist[nr][min_t(int, order_base_2(ns), HIST_BUCKETS - 1)]);
+        this_cpu_add(latency.sum[nr], ns);
+    }
+    return ret;
+}
+
+// Map the ring set up by PB2_SETUP_RING, the mapping keeps the file and hence the ring alive
+static int procfile_mmap(struct file *filep, struct vm_area_struct *vma) {
+    struct process_node *curr = filep->private_data;
+    struct priority_queue *pq = lock_pq(curr);
+    int ret;
+
+    if (curr->ring == NULL) {
+        pr_debug("Error: process %d has not set up a ring on this file\n", curr->pid);
+        ret = -EINVAL;
+    } else {
+        ret = remap_vmalloc_range(vma, curr->ring->mem, vma->vm_pgoff);
+    }
+    mutex_unlock(&pq->lock);
     return ret;
 }
 
+// Readable when the queue has an element, writable when it has free space. Pollers wait on
+// pollq of the file rather than on the queue, whose wakeups are passed on by poll_read and
+// poll_write. epoll keeps its registration for the life of the file, this way it follows
+// the file to a named queue attached after the first poll.
+static __poll_t procfile_poll(struct file *filep, poll_table *wait) {
+    struct process_node *curr = filep->private_data;
+    struct priority_queue *pq;
+    __poll_t mask = 0;
+
+    if (!poll_does_not_wait(wait) && !READ_ONCE(curr->polled)) {
+        pq = lock_pq(curr);
+        if (!curr->polled) {
+            hook_poll(curr, pq, 1);
+            WRITE_ONCE(curr->polled, 1);
+        }
+        wake_waiters(pq);
+        mutex_unlock(&pq->lock);
+    }
+    poll_wait(filep, &curr->pollq, wait);
+    pq = READ_ONCE(curr->proc_pq);
+    // Racy reads are fine, a change that happens after them wakes the poll table
+    if (READ_ONCE(curr->state) != PROC_FILE_OPEN) {
+        if (pq_readable(pq)) {
+            mask |= EPOLLIN | EPOLLRDNORM;
+        }
+        if (!pq_full(pq)) {
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        }
+    }
+    return mask;
+}
+
 static const struct proc_ops proc_fops = {
     .proc_open = procfile_open,
     .proc_release = procfile_close,
-    .proc_ioctl = proc_ioctl
+    .proc_ioctl = proc_ioctl,
+    .proc_mmap = procfile_mmap,
+    .proc_poll = procfile_poll
 };
 
+// The stats file, in the Prometheus text format: each counter over all queues, then for
+// every named queue, followed by the latency histogram of each ioctl used so far
+static int stats_show(struct seq_file *m, void *v) {
+    struct priority_queue *pq;
+    u64 buckets[HIST_BUCKETS], total, sum;
+    int stat, nr, b, cpu;
+
+    for (stat = 0; stat < NR_STATS; stat++) {
+        seq_printf(m, "# TYPE pb2_%s %s\n", stat_names[stat], stat == STAT_PEAK || stat == STAT_MEMORY ? "gauge" : "counter");
+        seq_printf(m, "pb2_%s %lld\n", stat_names[stat], stat_read(&global_stats, stat));
+        mutex_lock(&named_lock);
+        list_for_each_entry(pq, &named_queues, list) {
+            seq_printf(m, "pb2_%s{queue=\"%s\"} %lld\n", stat_names[stat], pq->name,
+                       stat == STAT_MEMORY ? (s64)pq_memory(pq) : stat_read(pq->stats, stat));
+        }
+        mutex_unlock(&named_lock);
+    }
+
+    seq_puts(m, "# TYPE pb2_ioctl_latency_ns histogram\n");
+    for (nr = 0; nr < PB2_NR_CMDS; nr++) {
+        memset(buckets, 0, sizeof(buckets));
+        sum = 0;
+        for_each_possible_cpu(cpu) {
+            for (b = 0; b < HIST_BUCKETS; b++) {
+                buckets[b] += per_cpu_ptr(&latency, cpu)->hist[nr][b];
+            }
+            sum += per_cpu_ptr(&latency, cpu)->sum[nr];
+        }
+        total = 0;
+        for (b = 0; b < HIST_BUCKETS; b++) {
+            total += buckets[b];
+        }
+        if (total == 0) {
+            continue;
+        }
+        // Buckets are cumulative, the last one only appears as +Inf
+        total = 0;
+        for (b = 0; b < HIST_BUCKETS - 1; b++) {
+            total += buckets[b];
+            seq_printf(m, "pb2_ioctl_latency_ns_bucket{cmd=\"%s\",le=\"%llu\"} %llu\n", cmd_names[nr], 1ULL << b, total);
+        }
+        total += buckets[HIST_BUCKETS - 1];
+        seq_printf(m, "pb2_ioctl_latency_ns_bucket{cmd=\"%s\",le=\"+Inf\"} %llu\n", cmd_names[nr], total);
+        seq_printf(m, "pb2_ioctl_latency_ns_sum{cmd=\"%s\"} %llu\n", cmd_names[nr], sum);
+        seq_printf(m, "pb2_ioctl_latency_ns_count{cmd=\"%s\"} %llu\n", cmd_names[nr], total);
+    }
+    return 0;
+}
+
+// Free the slab caches and the recycled heap arrays, kmem_cache_destroy() ignores NULL
+static void destroy_caches(void) {
+    kmem_cache_destroy(node_cache);
+    kmem_cache_destroy(pq_cache);
+    kmem_cache_destroy(pq_node_cache);
+    pool_drain();
+}
+
 // Module initialization
 static int __init lkm_init(void) {
     printk(KERN_INFO "LKM for cs60038_a2_grp3 loaded\n");
 
+    // Opens and closes come and go quickly, their objects get caches of their own
+    node_cache = KMEM_CACHE(process_node, 0);
+    pq_cache = KMEM_CACHE(priority_queue, SLAB_HWCACHE_ALIGN);
+    pq_node_cache = KMEM_CACHE(pq_node, 0);
+    if (node_cache == NULL || pq_cache == NULL || pq_node_cache == NULL) {
+        printk(KERN_ALERT "Error: could not create slab caches\n");
+        destroy_caches();
+        return -ENOMEM;
+    }
+
     proc_file = proc_create(PROCFS_NAME, 0666, NULL, &proc_fops);
     if (proc_file == NULL) {
         printk(KERN_ALERT "Error: could not create proc file\n");
+        destroy_caches();
         return -ENOENT;
     }
     printk(KERN_INFO "/proc/%s created\n", PROCFS_NAME);
+
+    // Without the stats file the queues still work, it is only reported
+    if (proc_create_single(STATS_NAME, 0444, NULL, stats_show) == NULL) {
+        printk(KERN_ALERT "Error: could not create /proc/%s\n", STATS_NAME);
+    }
     return 0;
 }
 
 // Module cleanup
 static void __exit lkm_exit(void) {
-    delete_process_list();
+    // Removing the entry releases the files that are still open, which frees their queues
+    remove_proc_entry(STATS_NAME, NULL);
     remove_proc_entry(PROCFS_NAME, NULL);
+    destroy_caches();
     printk(KERN_INFO "/proc/%s removed\n", PROCFS_NAME);
     printk(KERN_INFO "LKM for cs60038_a2_grp3 unloaded\n");
 }
@@ -0,0 +1,127 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+// Heap backend benchmark: fills a queue with n random elements through
+// PB2_INSERT_BATCH and drains it through PB2_GET_MIN_N, once per backend,
+// and reports the time per element of each phase. Batches keep the ioctl
+// overhead out of the numbers. Priorities are drawn from a wide range, then
+// from the small range the bucket queue supports, where it runs as well.
+//
+// Usage: ./backend [n...]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_GET_MIN_N _IOWR(0x10, 0x38, struct pb2_drain *)
+#define PB2_SET_BACKEND _IOW(0x10, 0x40, int32_t *)
+
+#define PB2_BACKEND_MINMAX 0
+#define PB2_BACKEND_DARY 1
+#define PB2_BACKEND_BUCKET 3
+
+#define PQ_UNBOUNDED (-1)
+#define CHUNK 4096
+#define WIDE_RANGE 1000000
+#define BUCKET_RANGE 4096  // PQ_BUCKET_PRIOS
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+struct pb2_drain {
+    void *buf;
+    int32_t count;
+    int32_t flags;
+    int32_t extracted;
+};
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fill and drain a queue of the given backend, returns 0 on success
+int execute(int backend, int n, int range, double *insert_ns, double *extract_ns) {
+    static struct pb2_pair pairs[CHUNK];
+    static int32_t out[CHUNK];
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int capacity = PQ_UNBOUNDED;
+    if (fd < 0 || ioctl(fd, PB2_SET_BACKEND, &backend) < 0 || ioctl(fd, PB2_SET_CAPACITY, &capacity) < 0) {
+        perror("setup");
+        return -1;
+    }
+
+    unsigned seed = 1;
+    double start = now();
+    for (int done = 0; done < n;) {
+        struct pb2_batch batch = {pairs, n - done < CHUNK ? n - done : CHUNK, 0};
+        for (int i = 0; i < batch.count; i++) {
+            pairs[i].val = done + i;
+            pairs[i].priority = 1 + rand_r(&seed) % range;
+        }
+        if (ioctl(fd, PB2_INSERT_BATCH, &batch) < 0) {
+            perror("insert");
+            return -1;
+        }
+        done += batch.accepted;
+    }
+    double mid = now();
+    for (int done = 0; done < n;) {
+        struct pb2_drain drain = {out, CHUNK, 0, 0};
+        if (ioctl(fd, PB2_GET_MIN_N, &drain) < 0) {
+            perror("extract");
+            return -1;
+        }
+        done += drain.extracted;
+    }
+    double end = now();
+
+    close(fd);
+    *insert_ns = (mid - start) * 1e9 / n;
+    *extract_ns = (end - mid) * 1e9 / n;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int defaults[] = {1000, 1000000, 16000000};
+    struct {
+        const char *name;
+        int backend;
+        int range;
+    } runs[] = {
+        {"minmax", PB2_BACKEND_MINMAX, WIDE_RANGE},
+        {"dary", PB2_BACKEND_DARY, WIDE_RANGE},
+        {"minmax", PB2_BACKEND_MINMAX, BUCKET_RANGE},
+        {"dary", PB2_BACKEND_DARY, BUCKET_RANGE},
+        {"bucket", PB2_BACKEND_BUCKET, BUCKET_RANGE},
+    };
+
+    printf("backend,range,n,insert_ns,extract_ns\n");
+    for (int i = 0; i < (argc > 1 ? argc - 1 : 3); i++) {
+        int n = argc > 1 ? atoi(argv[i + 1]) : defaults[i];
+        for (int r = 0; r < (int)(sizeof(runs) / sizeof(runs[0])); r++) {
+            double insert_ns, extract_ns;
+            if (execute(runs[r].backend, n, runs[r].range, &insert_ns, &extract_ns) == 0) {
+                printf("%s,%d,%d,%.1f,%.1f\n", runs[r].name, runs[r].range, n, insert_ns, extract_ns);
+            }
+        }
+    }
+    return 0;
+}
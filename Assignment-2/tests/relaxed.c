@@ -0,0 +1,130 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+// Shared queue benchmark: every process attaches to the same named queue and runs
+// insert/extract pairs for a fixed time, once on a strict queue and once on a
+// relaxed one. The strict queue serializes extractions on one lock, the relaxed
+// one should keep scaling with the number of processes.
+//
+// Usage: ./relaxed [max_procs] [seconds]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_INSERT_TIMED _IOW(0x10, 0x3e, struct pb2_timed_insert *)
+#define PB2_ATTACH _IOW(0x10, 0x3f, struct pb2_attach *)
+
+#define PB2_ATTACH_CREATE 0x1
+#define PB2_ATTACH_RELAXED 0x4
+#define PB2_NAME_LEN 32
+
+#define PQ_UNBOUNDED (-1)
+#define BURST 50
+
+struct pb2_timed_insert {
+    int32_t val;
+    int32_t priority;
+    int32_t timeout_ms;
+};
+
+struct pb2_attach {
+    char name[PB2_NAME_LEN];
+    int32_t capacity;
+    int32_t flags;
+};
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int attach(const char *name, int flags) {
+    struct pb2_attach req = {"", PQ_UNBOUNDED, flags};
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    strncpy(req.name, name, PB2_NAME_LEN - 1);
+    if (ioctl(fd, PB2_ATTACH, &req) < 0) {
+        perror("ioctl");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Run insert/extract bursts on the named queue until the deadline and return the number of ioctls done
+long execute(const char *name, double seconds) {
+    int fd = attach(name, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    long ops = 0;
+    unsigned seed = getpid();
+    double end = now() + seconds;
+    while (now() < end) {
+        for (int i = 0; i < BURST; i++) {
+            struct pb2_timed_insert req = {rand_r(&seed), 1 + rand_r(&seed) % 1000, 0};
+            ioctl(fd, PB2_INSERT_TIMED, &req);
+        }
+        for (int i = 0; i < BURST; i++) {
+            int out;
+            ioctl(fd, PB2_GET_MIN, &out);
+        }
+        ops += 2 * BURST;
+    }
+    close(fd);
+    return ops;
+}
+
+double run(int procs, double seconds, int flags) {
+    // The parent holds the queue open so that all children share one instance
+    int owner = attach("bench", PB2_ATTACH_CREATE | flags);
+    int fds[2];
+    pipe(fds);
+    for (int p = 0; p < procs; p++) {
+        if (fork() == 0) {
+            long ops = execute("bench", seconds);
+            write(fds[1], &ops, sizeof(long));
+            exit(0);
+        }
+    }
+    long total = 0;
+    for (int p = 0; p < procs; p++) {
+        long ops;
+        read(fds[0], &ops, sizeof(long));
+        total += ops > 0 ? ops : 0;
+        wait(NULL);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    close(owner);
+    return total / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    int max_procs = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+
+    printf("procs,strict_ops_per_sec,relaxed_ops_per_sec\n");
+    for (int procs = 1; procs <= max_procs; procs *= 2) {
+        double strict = run(procs, seconds, 0);
+        double relaxed = run(procs, seconds, PB2_ATTACH_RELAXED);
+        printf("%d,%.0f,%.0f\n", procs, strict, relaxed);
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+// Multi-process scaling benchmark: each process opens its own queue and runs
+// insert/extract pairs for a fixed time. With per-queue locks the aggregate
+// throughput should grow with the number of processes.
+//
+// Usage: ./scaling [max_procs] [seconds]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+
+#define CAPACITY 100
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run insert/extract pairs until the deadline and return the number of ioctls done
+long execute(double seconds) {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    int capacity = CAPACITY;
+    if (ioctl(fd, PB2_SET_CAPACITY, &capacity) < 0) {
+        perror("ioctl");
+        return -1;
+    }
+
+    long ops = 0;
+    unsigned seed = getpid();
+    double end = now() + seconds;
+    while (now() < end) {
+        // Keep the queue half full so both inserts and extracts succeed
+        for (int i = 0; i < CAPACITY / 2; i++) {
+            int val = rand_r(&seed), prio = 1 + rand_r(&seed) % 1000;
+            ioctl(fd, PB2_INSERT_INT, &val);
+            ioctl(fd, PB2_INSERT_PRIO, &prio);
+        }
+        for (int i = 0; i < CAPACITY / 2; i++) {
+            int out;
+            ioctl(fd, PB2_GET_MIN, &out);
+        }
+        ops += 3 * (CAPACITY / 2);
+    }
+    close(fd);
+    return ops;
+}
+
+int main(int argc, char *argv[]) {
+    int max_procs = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+
+    printf("procs,ops_per_sec\n");
+    for (int procs = 1; procs <= max_procs; procs *= 2) {
+        int fds[2];
+        pipe(fds);
+        for (int p = 0; p < procs; p++) {
+            if (fork() == 0) {
+                long ops = execute(seconds);
+                write(fds[1], &ops, sizeof(long));
+                exit(0);
+            }
+        }
+        long total = 0;
+        for (int p = 0; p < procs; p++) {
+            long ops;
+            read(fds[0], &ops, sizeof(long));
+            total += ops > 0 ? ops : 0;
+            wait(NULL);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        printf("%d,%.0f\n", procs, total / seconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wait.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_GET_INFO _IOR(0x10, 0x34, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_SET_MODE _IOW(0x10, 0x3d, int32_t *)
+#define PB2_ATTACH _IOW(0x10, 0x3f, struct pb2_attach *)
+
+#define PB2_MODE_BLOCK_READ 0x1
+#define PB2_ATTACH_CREATE 0x1
+#define PB2_NAME_LEN 32
+
+#define PRODUCERS 2
+#define CONSUMERS 2
+#define ITEMS 1000  // per producer
+#define BATCH 50
+
+struct obj_info {
+    int32_t prio_que_size;
+    int32_t capacity;
+};
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+struct pb2_attach {
+    char name[PB2_NAME_LEN];
+    int32_t capacity;
+    int32_t flags;
+};
+
+static int attach(const char *name, int flags) {
+    struct pb2_attach req = {"", 256, flags};
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    strncpy(req.name, name, PB2_NAME_LEN - 1);
+    if (ioctl(fd, PB2_ATTACH, &req) < 0) {
+        printf("[Proc %d] Attach to %s failed, Errno: %d\n", getpid(), name, errno);
+        exit(1);
+    }
+    return fd;
+}
+
+// Independent opens of the proc file meet on one named queue, producers and consumers run at once
+int main() {
+    struct pb2_attach req = {"missing", 0, 0};
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_ATTACH, &req);
+    printf("[Proc %d] Attach to missing queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    close(fd);
+
+    // Keeps the queue alive while the children come and go
+    int owner = attach("jobs", PB2_ATTACH_CREATE);
+    int capacity = 8;
+    ret = ioctl(owner, PB2_SET_CAPACITY, &capacity);
+    printf("[Proc %d] Set capacity of named queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        if (fork() == 0) {
+            int pfd = attach("jobs", 0);
+            struct pb2_pair pairs[BATCH];
+            for (int i = 0; i < ITEMS;) {
+                struct pb2_batch batch = {pairs, BATCH, 0};
+                for (int j = 0; j < BATCH; j++) {
+                    pairs[j].val = p * ITEMS + i + j;
+                    pairs[j].priority = 1 + (i + j) % 10;
+                }
+                if (ioctl(pfd, PB2_INSERT_BATCH, &batch) < 0) {
+                    // Queue full, let the consumers catch up
+                    usleep(100);
+                    continue;
+                }
+                i += batch.accepted;
+            }
+            close(pfd);
+            return 0;
+        }
+    }
+    for (int c = 0; c < CONSUMERS; c++) {
+        if (fork() == 0) {
+            int cfd = attach("jobs", 0);
+            int mode = PB2_MODE_BLOCK_READ, out, got = 0;
+            ioctl(cfd, PB2_SET_MODE, &mode);
+            while (got < PRODUCERS * ITEMS / CONSUMERS && ioctl(cfd, PB2_GET_MIN, &out) == 0) {
+                got++;
+            }
+            printf("[Proc %d] Consumed: %d\n", getpid(), got);
+            close(cfd);
+            return 0;
+        }
+    }
+    while (wait(NULL) > 0)
+        ;
+
+    struct obj_info info;
+    ret = ioctl(owner, PB2_GET_INFO, &info);
+    printf("[Proc %d] Left in queue: %d, Capacity: %d, Return: %d\n", getpid(), info.prio_que_size, info.capacity, ret);
+    close(owner);
+    return 0;
+}
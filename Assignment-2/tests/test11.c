@@ -0,0 +1,85 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_INSERT_HANDLE _IOWR(0x10, 0x41, struct pb2_handle_insert *)
+#define PB2_UPDATE_PRIO _IOW(0x10, 0x42, struct pb2_update *)
+#define PB2_DELETE _IOW(0x10, 0x43, int64_t *)
+
+struct pb2_handle_insert {
+    int32_t val;
+    int32_t priority;
+    int64_t handle;
+};
+
+struct pb2_update {
+    int64_t handle;
+    int32_t priority;
+    int32_t pad;
+};
+
+// Elements are reprioritized and cancelled through the handles returned by their inserts
+int main() {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int capacity = 10;
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+
+    struct pb2_handle_insert items[5];
+    for (int i = 0; i < 5; i++) {
+        items[i].val = 100 + i;
+        items[i].priority = 10 * (i + 1);
+        ret = ioctl(fd, PB2_INSERT_HANDLE, &items[i]);
+        printf("[Proc %d] Inserted: %d, Priority: %d, Return: %d, Handle: %#llx\n", getpid(), items[i].val, items[i].priority, ret, (long long)items[i].handle);
+    }
+
+    // 104 jumps to the front, 100 goes to the back
+    struct pb2_update up = {items[4].handle, 1, 0};
+    ret = ioctl(fd, PB2_UPDATE_PRIO, &up);
+    printf("[Proc %d] Updated %d to priority 1, Return: %d, Errno: %d\n", getpid(), items[4].val, ret, errno);
+    struct pb2_update down = {items[0].handle, 99, 0};
+    ret = ioctl(fd, PB2_UPDATE_PRIO, &down);
+    printf("[Proc %d] Updated %d to priority 99, Return: %d, Errno: %d\n", getpid(), items[0].val, ret, errno);
+
+    ret = ioctl(fd, PB2_DELETE, &items[2].handle);
+    printf("[Proc %d] Deleted %d, Return: %d, Errno: %d\n", getpid(), items[2].val, ret, errno);
+    ret = ioctl(fd, PB2_DELETE, &items[2].handle);
+    printf("[Proc %d] Deleted %d again, Return: %d, Errno: %d\n", getpid(), items[2].val, ret, errno);
+
+    // Expected order: 104, 101, 103, 100
+    for (int i = 0; i < 4; i++) {
+        int out;
+        ret = ioctl(fd, PB2_GET_MIN, &out);
+        printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+    }
+
+    // The handle of an extracted element is stale
+    ret = ioctl(fd, PB2_UPDATE_PRIO, &up);
+    printf("[Proc %d] Update of extracted element, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    // Setting the capacity drops the queued elements, their handles must not match the new ones
+    struct pb2_handle_insert old = {200, 5, 0}, new = {201, 5, 0};
+    ret = ioctl(fd, PB2_INSERT_HANDLE, &old);
+    printf("[Proc %d] Inserted: %d, Return: %d, Handle: %#llx\n", getpid(), old.val, ret, (long long)old.handle);
+    ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    printf("[Proc %d] Set capacity: %d, Return: %d\n", getpid(), capacity, ret);
+    ret = ioctl(fd, PB2_INSERT_HANDLE, &new);
+    printf("[Proc %d] Inserted: %d, Return: %d, Handle: %#llx\n", getpid(), new.val, ret, (long long)new.handle);
+    ret = ioctl(fd, PB2_DELETE, &old.handle);
+    printf("[Proc %d] Delete through handle from before the reset, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    int out;
+    ret = ioctl(fd, PB2_GET_MIN, &out);
+    printf("[Proc %d] Read Min: %d, Return: %d\n", getpid(), out, ret);
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_GET_MAX _IOR(0x10, 0x36, int32_t *)
+#define PB2_BULK_LOAD _IOWR(0x10, 0x44, struct pb2_batch *)
+
+#define N 8
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+// An array is loaded in one call and comes out in priority order, ties in array order
+int main() {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int capacity = N + 2;
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+
+    int val = 500, prio = 4;
+    ret = ioctl(fd, PB2_INSERT_INT, &val);
+    ret = ioctl(fd, PB2_INSERT_PRIO, &prio);
+    printf("[Proc %d] Inserted: %d, Priority: %d, Return: %d\n", getpid(), val, prio, ret);
+
+    struct pb2_pair pairs[N];
+    for (int i = 0; i < N; i++) {
+        pairs[i].val = 100 + i;
+        pairs[i].priority = (N - i) % 5 + 1;
+    }
+    struct pb2_batch batch = {pairs, N, 0};
+    ret = ioctl(fd, PB2_BULK_LOAD, &batch);
+    printf("[Proc %d] Bulk loaded: %d of %d, Return: %d, Errno: %d\n", getpid(), batch.accepted, N, ret, errno);
+
+    // Only one slot left
+    batch.accepted = 0;
+    ret = ioctl(fd, PB2_BULK_LOAD, &batch);
+    printf("[Proc %d] Bulk loaded into nearly full queue: %d of %d, Return: %d, Errno: %d\n", getpid(), batch.accepted, N, ret, errno);
+
+    int out;
+    ret = ioctl(fd, PB2_GET_MAX, &out);
+    printf("[Proc %d] Read Max: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+    for (int i = 0; i < N + 1; i++) {
+        ret = ioctl(fd, PB2_GET_MIN, &out);
+        printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+    }
+
+    close(fd);
+    return 0;
+}
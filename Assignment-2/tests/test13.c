@@ -0,0 +1,86 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_GET_INFO _IOR(0x10, 0x34, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_SET_BACKEND _IOW(0x10, 0x40, int32_t *)
+#define PB2_MELD _IOW(0x10, 0x45, int32_t *)
+
+#define PB2_BACKEND_MINMAX 0
+#define PB2_BACKEND_PAIRING 2
+
+struct obj_info {
+    int32_t prio_que_size;
+    int32_t capacity;
+};
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+static int open_queue(int backend, int capacity, int first_val) {
+    struct pb2_pair pairs[3];
+    struct pb2_batch batch = {pairs, 3, 0};
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    ioctl(fd, PB2_SET_BACKEND, &backend);
+    ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    for (int i = 0; i < 3; i++) {
+        pairs[i].val = first_val + i;
+        pairs[i].priority = 1 + i % 2;
+    }
+    int ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+    printf("[Proc %d] Inserted %d elements from %d, Return: %d\n", getpid(), batch.accepted, first_val, ret);
+    return fd;
+}
+
+// The work of one queue is handed to another in a single call, ties keep their insertion order
+int main() {
+    int dst = open_queue(PB2_BACKEND_PAIRING, 10, 100);
+    int src = open_queue(PB2_BACKEND_PAIRING, 10, 200);
+    int old = open_queue(PB2_BACKEND_MINMAX, 10, 300);
+    int small = open_queue(PB2_BACKEND_PAIRING, 4, 400);
+
+    int ret = ioctl(dst, PB2_MELD, &src);
+    printf("[Proc %d] Melded pairing queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    ret = ioctl(dst, PB2_MELD, &old);
+    printf("[Proc %d] Melded min-max queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    ret = ioctl(small, PB2_MELD, &dst);
+    printf("[Proc %d] Melded into a queue without room, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    ret = ioctl(dst, PB2_MELD, &dst);
+    printf("[Proc %d] Melded queue into itself, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    struct obj_info info;
+    ioctl(src, PB2_GET_INFO, &info);
+    printf("[Proc %d] Left in melded queue: %d\n", getpid(), info.prio_que_size);
+
+    // Expected order: 100, 102, 200, 202, 300, 302, 101, 201, 301
+    for (int i = 0; i < 9; i++) {
+        int out;
+        ret = ioctl(dst, PB2_GET_MIN, &out);
+        printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+    }
+
+    close(small);
+    close(old);
+    close(src);
+    close(dst);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_ATTACH _IOW(0x10, 0x3f, struct pb2_attach *)
+
+#define PB2_ATTACH_CREATE 0x1
+#define PB2_NAME_LEN 32
+
+#define N 6
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+struct pb2_attach {
+    char name[PB2_NAME_LEN];
+    int32_t capacity;
+    int32_t flags;
+};
+
+// The lines of the stats file that mention the named queue
+static void print_queue_stats(const char *name) {
+    char line[256], label[64];
+    FILE *f = fopen("/proc/cs60038_a2_grp3_stats", "r");
+    if (f == NULL) {
+        printf("[Proc %d] Could not open stats file, Errno: %d\n", getpid(), errno);
+        return;
+    }
+    snprintf(label, sizeof(label), "{queue=\"%s\"}", name);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strstr(line, label) != NULL) {
+            printf("%s", line);
+        }
+    }
+    fclose(f);
+}
+
+// Counters of a named queue: 6 inserts into room for 4, then 5 extractions from 4 elements
+int main() {
+    struct pb2_attach req = {"stats_test", 4, PB2_ATTACH_CREATE};
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_ATTACH, &req);
+    printf("[Proc %d] Attached to %s, Return: %d\n", getpid(), req.name, ret);
+
+    struct pb2_pair pairs[N];
+    for (int i = 0; i < N; i++) {
+        pairs[i].val = 100 + i;
+        pairs[i].priority = 1 + i;
+    }
+    struct pb2_batch batch = {pairs, 4, 0};
+    ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+    printf("[Proc %d] Inserted %d elements, Return: %d\n", getpid(), batch.accepted, ret);
+    for (int i = 4; i < N; i++) {
+        batch.pairs = &pairs[i];
+        batch.count = 1;
+        batch.accepted = 0;
+        ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+        printf("[Proc %d] Insert into full queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    }
+    for (int i = 0; i < 5; i++) {
+        int out;
+        ret = ioctl(fd, PB2_GET_MIN, &out);
+        printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+    }
+
+    // Expected: inserts 4, extracts 4, full rejections 2, empty rejections 1, peak size 4
+    print_queue_stats(req.name);
+    close(fd);
+    return 0;
+}
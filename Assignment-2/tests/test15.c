@@ -0,0 +1,80 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_INFO _IOR(0x10, 0x34, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+
+#define THREADS 4
+#define PER_THREAD 1000
+
+struct obj_info {
+    int32_t prio_que_size;  // current number of elements in priority queue
+    int32_t capacity;       // maximum capacity of priority queue
+};
+
+static int fd;
+
+// Every thread runs the two step insert on the shared fd, the value sent by one thread
+// must not be paired with the priority sent by another
+void *execute(void *arg) {
+    int id = (int)(long)arg;
+    int errors = 0;
+
+    for (int i = 0; i < PER_THREAD; i++) {
+        // The priority of a value is recoverable from the value, so mismatches show up on extraction
+        int val = id * PER_THREAD + i;
+        int prio = val + 1;
+        if (ioctl(fd, PB2_INSERT_INT, &val) < 0 || ioctl(fd, PB2_INSERT_PRIO, &prio) < 0) {
+            errors++;
+        }
+    }
+    printf("[Thread %ld] Inserted %d values, Errors: %d\n", syscall(SYS_gettid), PER_THREAD, errors);
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[THREADS];
+    int capacity = THREADS * PER_THREAD;
+
+    fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    printf("[Proc %d] Set capacity: %d, Return: %d\n", getpid(), capacity, ret);
+
+    for (long i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, execute, (void *)i);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    struct obj_info info;
+    ret = ioctl(fd, PB2_GET_INFO, &info);
+    printf("[Proc %d] Size: %d, Capacity: %d, Return: %d\n", getpid(), info.prio_que_size, info.capacity, ret);
+
+    // Priorities were val + 1, so the values come out as 0, 1, 2, ... in order
+    int expected = 0, out;
+    while (ioctl(fd, PB2_GET_MIN, &out) == 0) {
+        if (out != expected) {
+            printf("[Proc %d] Read Min: %d, Expected: %d\n", getpid(), out, expected);
+            break;
+        }
+        expected++;
+    }
+    printf("[Proc %d] Read %d values in order, Errno: %d\n", getpid(), expected, errno);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_SET_MODE _IOW(0x10, 0x3d, int32_t *)
+
+#define PB2_MODE_COMBINE 0x4
+
+#define THREADS 4
+#define N 100000
+
+static int fd;
+static char seen[N];
+
+// Extract until the queue is empty. Values were inserted with priority val + 1, so each
+// thread must see them increasing and no value may be returned twice.
+void *execute(void *arg) {
+    int out, last = -1, count = 0, errors = 0;
+
+    while (ioctl(fd, PB2_GET_MIN, &out) == 0) {
+        if (out <= last || out < 0 || out >= N || __atomic_exchange_n(&seen[out], 1, __ATOMIC_RELAXED)) {
+            errors++;
+        }
+        last = out;
+        count++;
+    }
+    printf("[Thread %ld] Read %d values, Errors: %d, Errno: %d\n", syscall(SYS_gettid), count, errors, errno);
+    return NULL;
+}
+
+// The global counter of requests served by a combiner
+static void print_combined() {
+    char line[256];
+    FILE *f = fopen("/proc/cs60038_a2_grp3_stats", "r");
+    if (f == NULL) {
+        printf("[Proc %d] Could not open stats file, Errno: %d\n", getpid(), errno);
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "pb2_combined_total ", 19) == 0) {
+            printf("%s", line);
+        }
+    }
+    fclose(f);
+}
+
+int main() {
+    pthread_t threads[THREADS];
+    int capacity = N, mode = PB2_MODE_COMBINE;
+
+    fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    printf("[Proc %d] Set capacity: %d, Return: %d\n", getpid(), capacity, ret);
+    ret = ioctl(fd, PB2_SET_MODE, &mode);
+    printf("[Proc %d] Set combining mode, Return: %d\n", getpid(), ret);
+
+    for (int i = 0; i < N; i++) {
+        int prio = i + 1;
+        if (ioctl(fd, PB2_INSERT_INT, &i) < 0 || ioctl(fd, PB2_INSERT_PRIO, &prio) < 0) {
+            printf("[Proc %d] Insert of %d failed, Errno: %d\n", getpid(), i, errno);
+            return 1;
+        }
+    }
+    printf("[Proc %d] Inserted %d values\n", getpid(), N);
+
+    for (long i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, execute, NULL);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int total = 0;
+    for (int i = 0; i < N; i++) {
+        total += seen[i];
+    }
+    printf("[Proc %d] Distinct values read: %d of %d\n", getpid(), total, N);
+    print_combined();
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_GET_MAX _IOR(0x10, 0x36, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_SET_BACKEND _IOW(0x10, 0x40, int32_t *)
+
+#define PB2_BACKEND_BUCKET 3
+#define PQ_BUCKET_PRIOS 4096
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+// A bucket queue keeps the order of the heaps: priority first, ties in insertion order
+// from the minimum side and newest first from the maximum side
+int main() {
+    int backend = PB2_BACKEND_BUCKET, capacity = 10;
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_SET_BACKEND, &backend);
+    printf("[Proc %d] Set bucket backend, Return: %d\n", getpid(), ret);
+    ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    printf("[Proc %d] Set capacity: %d, Return: %d\n", getpid(), capacity, ret);
+
+    struct pb2_pair pairs[] = {{10, 7}, {11, 3}, {12, 7}, {13, 3}, {14, PQ_BUCKET_PRIOS}, {15, 3}};
+    struct pb2_batch batch = {pairs, sizeof(pairs) / sizeof(pairs[0]), 0};
+    ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+    printf("[Proc %d] Inserted %d elements, Return: %d\n", getpid(), batch.accepted, ret);
+
+    // Priorities above PQ_BUCKET_PRIOS are rejected
+    int val = 16, prio = PQ_BUCKET_PRIOS + 1;
+    ioctl(fd, PB2_INSERT_INT, &val);
+    ret = ioctl(fd, PB2_INSERT_PRIO, &prio);
+    printf("[Proc %d] Write: %d, Return: %d, Errno: %d\n", getpid(), prio, ret, errno);
+    prio = 1;
+    ret = ioctl(fd, PB2_INSERT_PRIO, &prio);
+    printf("[Proc %d] Write: %d, Return: %d\n", getpid(), prio, ret);
+
+    // Expected: 16 11 14 12 13 15 10, then an empty queue
+    int out;
+    ret = ioctl(fd, PB2_GET_MIN, &out);
+    printf("[Proc %d] Read Min: %d, Return: %d\n", getpid(), out, ret);
+    ret = ioctl(fd, PB2_GET_MIN, &out);
+    printf("[Proc %d] Read Min: %d, Return: %d\n", getpid(), out, ret);
+    ret = ioctl(fd, PB2_GET_MAX, &out);
+    printf("[Proc %d] Read Max: %d, Return: %d\n", getpid(), out, ret);
+    ret = ioctl(fd, PB2_GET_MAX, &out);
+    printf("[Proc %d] Read Max: %d, Return: %d\n", getpid(), out, ret);
+    for (int i = 0; i < 4; i++) {
+        ret = ioctl(fd, PB2_GET_MIN, &out);
+        printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wait.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_SET_MODE _IOW(0x10, 0x3d, int32_t *)
+#define PB2_INSERT_TIMED _IOW(0x10, 0x3e, struct pb2_timed_insert *)
+
+#define PB2_MODE_BLOCK_WRITE 0x2
+
+struct pb2_timed_insert {
+    int32_t val;
+    int32_t priority;
+    int32_t timeout_ms;
+};
+
+// Producers blocked on a full queue get the freed slots in the order they started waiting,
+// even though the later ones insert with a better priority
+int main() {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int capacity = 1;
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    int mode = PB2_MODE_BLOCK_WRITE;
+    ret = ioctl(fd, PB2_SET_MODE, &mode);
+
+    struct pb2_timed_insert first = {0, 100, 0};
+    ret = ioctl(fd, PB2_INSERT_TIMED, &first);
+    printf("[Proc %d] Inserted: %d, Return: %d, Errno: %d\n", getpid(), first.val, ret, errno);
+
+    for (int i = 1; i <= 3; i++) {
+        if (fork() == 0) {
+            struct pb2_timed_insert req = {i, 10 - i, 10000};
+            usleep(200000 * i);
+            ret = ioctl(fd, PB2_INSERT_TIMED, &req);
+            printf("[Proc %d] Inserted: %d, Return: %d, Errno: %d\n", getpid(), req.val, ret, errno);
+            return 0;
+        }
+    }
+
+    // Expected order: 0, 1, 2, 3
+    sleep(1);
+    for (int i = 0; i < 4; i++) {
+        int out;
+        ret = ioctl(fd, PB2_GET_MIN, &out);
+        printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+        usleep(200000);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        wait(NULL);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_GET_INFO _IOR(0x10, 0x34, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_GET_MAX _IOR(0x10, 0x36, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+
+struct obj_info {
+    int32_t prio_que_size;  // current number of elements in priority queue
+    int32_t capacity;       // maximum capacity of priority queue
+};
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;  // user array of value-priority pairs
+    int32_t count;           // number of pairs in the array
+    int32_t accepted;        // set to the number of pairs inserted
+};
+
+// Insert a whole batch with one ioctl, the queue fills up partway through
+void execute(struct pb2_pair pairs[], int n, int capacity) {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+
+    struct pb2_batch batch = {pairs, n, 0};
+    ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+    printf("[Proc %d] Batch of %d, Accepted: %d, Return: %d, Errno: %d\n", getpid(), n, batch.accepted, ret, errno);
+
+    ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+    printf("[Proc %d] Batch on full queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    struct obj_info info;
+    ret = ioctl(fd, PB2_GET_INFO, &info);
+    printf("[Proc %d] Current Size: %d, Capacity: %d, Return: %d, Errno: %d\n", getpid(), info.prio_que_size, info.capacity, ret, errno);
+
+    for (int i = 0; i * 2 < capacity; i++) {
+        int out;
+        ret = ioctl(fd, PB2_GET_MIN, &out);
+        printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+
+        ret = ioctl(fd, PB2_GET_MAX, &out);
+        printf("[Proc %d] Read Max: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+    }
+    close(fd);
+}
+
+int main() {
+    struct pb2_pair pairs[] = {{0, 5}, {1, 2}, {-2, 9}, {3, 2}, {4, 6}, {3, 1}, {7, 4}, {8, 3}};
+
+    execute(pairs, sizeof(pairs) / sizeof(struct pb2_pair), 6);
+
+    return 0;
+}
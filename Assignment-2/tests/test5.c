@@ -0,0 +1,80 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_GET_MIN_N _IOWR(0x10, 0x38, struct pb2_drain *)
+#define PB2_GET_MAX_N _IOWR(0x10, 0x39, struct pb2_drain *)
+
+#define PB2_DRAIN_RECORDS 0x1
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+struct pb2_record {
+    int32_t val;
+    int32_t priority;
+    int32_t insert_time;
+};
+
+struct pb2_drain {
+    void *buf;
+    int32_t count;
+    int32_t flags;
+    int32_t extracted;
+};
+
+// Drain the queue in chunks, values only from the min end and full records from the max end
+void execute(struct pb2_pair pairs[], int n) {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &n);
+
+    struct pb2_batch batch = {pairs, n, 0};
+    ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+    printf("[Proc %d] Batch of %d, Accepted: %d, Return: %d, Errno: %d\n", getpid(), n, batch.accepted, ret, errno);
+
+    int32_t values[3];
+    struct pb2_drain drain = {values, 3, 0, 0};
+    ret = ioctl(fd, PB2_GET_MIN_N, &drain);
+    printf("[Proc %d] Min drain, Extracted: %d, Return: %d, Errno: %d\n", getpid(), drain.extracted, ret, errno);
+    for (int i = 0; i < drain.extracted; i++) {
+        printf("[Proc %d] Read Min: %d\n", getpid(), values[i]);
+    }
+
+    struct pb2_record records[8];
+    drain = (struct pb2_drain){records, 8, PB2_DRAIN_RECORDS, 0};
+    ret = ioctl(fd, PB2_GET_MAX_N, &drain);
+    printf("[Proc %d] Max drain, Extracted: %d, Return: %d, Errno: %d\n", getpid(), drain.extracted, ret, errno);
+    for (int i = 0; i < drain.extracted; i++) {
+        printf("[Proc %d] Read Max: %d, Priority: %d, Insert time: %d\n", getpid(), records[i].val, records[i].priority, records[i].insert_time);
+    }
+
+    ret = ioctl(fd, PB2_GET_MIN_N, &drain);
+    printf("[Proc %d] Drain on empty queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+    close(fd);
+}
+
+int main() {
+    struct pb2_pair pairs[] = {{0, 5}, {1, 2}, {-2, 9}, {3, 2}, {4, 6}, {3, 1}, {7, 4}};
+
+    execute(pairs, sizeof(pairs) / sizeof(struct pb2_pair));
+
+    return 0;
+}
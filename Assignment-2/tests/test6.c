@@ -0,0 +1,84 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_GET_MIN_N _IOWR(0x10, 0x38, struct pb2_drain *)
+#define PB2_GET_INFO_EXT _IOR(0x10, 0x3a, struct obj_info_ext *)
+
+#define PQ_UNBOUNDED (-1)
+
+struct obj_info_ext {
+    int32_t prio_que_size;
+    int32_t capacity;
+    int64_t allocated;
+    int64_t footprint;
+};
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+struct pb2_drain {
+    void *buf;
+    int32_t count;
+    int32_t flags;
+    int32_t extracted;
+};
+
+void print_info(int fd) {
+    struct obj_info_ext info;
+    int ret = ioctl(fd, PB2_GET_INFO_EXT, &info);
+    printf("[Proc %d] Size: %d, Capacity: %d, Allocated: %lld, Footprint: %lld bytes, Return: %d, Errno: %d\n", getpid(), info.prio_que_size,
+           info.capacity, (long long)info.allocated, (long long)info.footprint, ret, errno);
+}
+
+// Grow an unbounded queue to a million elements and watch the heap shrink back as it drains
+void execute(int n) {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int capacity = PQ_UNBOUNDED;
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    print_info(fd);
+
+    struct pb2_pair *pairs = malloc(n * sizeof(struct pb2_pair));
+    for (int i = 0; i < n; i++) {
+        pairs[i].val = i;
+        pairs[i].priority = 1 + rand() % 1000;
+    }
+    struct pb2_batch batch = {pairs, n, 0};
+    ret = ioctl(fd, PB2_INSERT_BATCH, &batch);
+    printf("[Proc %d] Batch of %d, Accepted: %d, Return: %d, Errno: %d\n", getpid(), n, batch.accepted, ret, errno);
+    print_info(fd);
+
+    int32_t *values = malloc(n * sizeof(int32_t));
+    struct pb2_drain drain = {values, n - 10, 0, 0};
+    ret = ioctl(fd, PB2_GET_MIN_N, &drain);
+    printf("[Proc %d] Drained: %d, Return: %d, Errno: %d\n", getpid(), drain.extracted, ret, errno);
+    print_info(fd);
+
+    free(values);
+    free(pairs);
+    close(fd);
+}
+
+int main() {
+    execute(1 << 20);
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_SETUP_RING _IOWR(0x10, 0x3b, struct pb2_ring_params *)
+#define PB2_RING_ENTER _IO(0x10, 0x3c)
+
+#define PB2_OP_INSERT 1
+#define PB2_OP_GET_MIN 2
+#define PB2_OP_GET_MAX 3
+
+struct pb2_ring_params {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_off;
+    uint32_t cq_off;
+    uint32_t ring_size;
+};
+
+struct pb2_ring_hdr {
+    uint32_t sq_head;
+    uint32_t sq_tail;
+    uint32_t cq_head;
+    uint32_t cq_tail;
+    uint32_t sq_mask;
+    uint32_t cq_mask;
+};
+
+struct pb2_sqe {
+    uint32_t opcode;
+    int32_t val;
+    int32_t priority;
+    uint32_t pad;
+    uint64_t user_data;
+};
+
+struct pb2_cqe {
+    uint64_t user_data;
+    int32_t res;
+    int32_t val;
+    int32_t priority;
+    int32_t insert_time;
+};
+
+struct pb2_ring_hdr *hdr;
+struct pb2_sqe *sqes;
+struct pb2_cqe *cqes;
+
+void submit(uint32_t opcode, int val, int priority) {
+    uint32_t tail = hdr->sq_tail;
+    struct pb2_sqe *sqe = &sqes[tail & hdr->sq_mask];
+    sqe->opcode = opcode;
+    sqe->val = val;
+    sqe->priority = priority;
+    sqe->user_data = tail;
+    __atomic_store_n(&hdr->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void reap() {
+    uint32_t head = hdr->cq_head;
+    uint32_t tail = __atomic_load_n(&hdr->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct pb2_cqe *cqe = &cqes[head & hdr->cq_mask];
+        printf("[Proc %d] Completion %llu, Res: %d, Value: %d, Priority: %d\n", getpid(), (unsigned long long)cqe->user_data, cqe->res, cqe->val,
+               cqe->priority);
+    }
+    __atomic_store_n(&hdr->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Submit inserts and extracts through the shared rings with a single doorbell ioctl
+void execute(int val[], int n, int prio[]) {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &n);
+
+    struct pb2_ring_params params = {16, 0, 0, 0, 0};
+    ret = ioctl(fd, PB2_SETUP_RING, &params);
+    printf("[Proc %d] Ring setup, SQ: %u, CQ: %u, Size: %u, Return: %d, Errno: %d\n", getpid(), params.sq_entries, params.cq_entries, params.ring_size,
+           ret, errno);
+    void *mem = mmap(NULL, params.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    hdr = mem;
+    sqes = (struct pb2_sqe *)((char *)mem + params.sq_off);
+    cqes = (struct pb2_cqe *)((char *)mem + params.cq_off);
+
+    for (int i = 0; i < n; i++) {
+        submit(PB2_OP_INSERT, val[i], prio[i]);
+    }
+    submit(PB2_OP_INSERT, 100, 1);  // the queue is full by now
+    submit(PB2_OP_GET_MIN, 0, 0);
+    submit(PB2_OP_GET_MAX, 0, 0);
+    ret = ioctl(fd, PB2_RING_ENTER);
+    printf("[Proc %d] Ring enter, Consumed: %d, Errno: %d\n", getpid(), ret, errno);
+    reap();
+
+    munmap(mem, params.ring_size);
+    close(fd);
+}
+
+int main() {
+    int val_p[] = {0, 1, -2, 3, 4, 6};
+    int prio_p[] = {5, 2, 9, 2, 3, 1};
+
+    execute(val_p, sizeof(val_p) / sizeof(int), prio_p);
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wait.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_SET_MODE _IOW(0x10, 0x3d, int32_t *)
+#define PB2_ATTACH _IOW(0x10, 0x3f, struct pb2_attach *)
+
+#define PB2_MODE_BLOCK_READ 0x1
+#define PB2_ATTACH_CREATE 0x1
+#define PB2_NAME_LEN 32
+
+struct pb2_attach {
+    char name[PB2_NAME_LEN];
+    int32_t capacity;
+    int32_t flags;
+};
+
+// The forked child shares the open file and hence the queue, the parent blocks until it produces
+int main() {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int capacity = 4;
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+
+    int out;
+    ret = ioctl(fd, PB2_GET_MIN, &out);
+    printf("[Proc %d] Non-blocking read on empty queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    int mode = PB2_MODE_BLOCK_READ;
+    ret = ioctl(fd, PB2_SET_MODE, &mode);
+
+    int pid = fork();
+    if (pid == 0) {
+        int val[] = {7, 3}, prio[] = {2, 1};
+        for (int i = 0; i < 2; i++) {
+            sleep(1);
+            ret = ioctl(fd, PB2_INSERT_INT, &val[i]);
+            ret = ioctl(fd, PB2_INSERT_PRIO, &prio[i]);
+            printf("[Proc %d] Inserted: %d, Return: %d, Errno: %d\n", getpid(), val[i], ret, errno);
+        }
+        return 0;
+    }
+
+    ret = ioctl(fd, PB2_GET_MIN, &out);
+    printf("[Proc %d] Blocking read: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ret = poll(&pfd, 1, 5000);
+    printf("[Proc %d] Poll, Return: %d, Revents: %#x\n", getpid(), ret, pfd.revents);
+    ret = ioctl(fd, PB2_GET_MIN, &out);
+    printf("[Proc %d] Read after poll: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    ret = ioctl(fd, PB2_GET_MIN, &out);
+    printf("[Proc %d] O_NONBLOCK read on empty queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    wait(NULL);
+    close(fd);
+
+    // epoll registers once, a file added before it attaches must still see the named queue
+    int efd = epoll_create1(0);
+    int named = open("/proc/cs60038_a2_grp3", O_RDWR);
+    struct epoll_event ev = {EPOLLIN, {.fd = named}};
+    ret = epoll_ctl(efd, EPOLL_CTL_ADD, named, &ev);
+    struct pb2_attach req = {"test8", 4, PB2_ATTACH_CREATE};
+    ret = ioctl(named, PB2_ATTACH, &req);
+    printf("[Proc %d] Attached after epoll_ctl, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    pid = fork();
+    if (pid == 0) {
+        int other = open("/proc/cs60038_a2_grp3", O_RDWR), val = 5, prio = 1;
+        req.flags = 0;
+        ioctl(other, PB2_ATTACH, &req);
+        sleep(1);
+        ret = ioctl(other, PB2_INSERT_INT, &val);
+        ret = ioctl(other, PB2_INSERT_PRIO, &prio);
+        printf("[Proc %d] Inserted into named queue: %d, Return: %d\n", getpid(), val, ret);
+        close(other);
+        return 0;
+    }
+    ret = epoll_wait(efd, &ev, 1, 5000);
+    printf("[Proc %d] epoll_wait, Return: %d, Events: %#x\n", getpid(), ret, ret > 0 ? ev.events : 0);
+    ret = ioctl(named, PB2_GET_MIN, &out);
+    printf("[Proc %d] Read after epoll_wait: %d, Return: %d\n", getpid(), out, ret);
+
+    wait(NULL);
+    close(named);
+    close(efd);
+    return 0;
+}
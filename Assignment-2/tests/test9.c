@@ -0,0 +1,62 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wait.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_SET_MODE _IOW(0x10, 0x3d, int32_t *)
+#define PB2_INSERT_TIMED _IOW(0x10, 0x3e, struct pb2_timed_insert *)
+
+#define PB2_MODE_BLOCK_WRITE 0x2
+
+struct pb2_timed_insert {
+    int32_t val;
+    int32_t priority;
+    int32_t timeout_ms;
+};
+
+// A producer on a full bounded queue sleeps until the forked consumer sharing the file makes room
+int main() {
+    int fd = open("/proc/cs60038_a2_grp3", O_RDWR);
+    int capacity = 2;
+    int ret = ioctl(fd, PB2_SET_CAPACITY, &capacity);
+    int mode = PB2_MODE_BLOCK_WRITE;
+    ret = ioctl(fd, PB2_SET_MODE, &mode);
+
+    int pid = fork();
+    if (pid == 0) {
+        for (int i = 0; i < 2; i++) {
+            int out;
+            sleep(1);
+            ret = ioctl(fd, PB2_GET_MIN, &out);
+            printf("[Proc %d] Read Min: %d, Return: %d, Errno: %d\n", getpid(), out, ret, errno);
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        int prio = 10 - i;
+        ret = ioctl(fd, PB2_INSERT_INT, &i);
+        ret = ioctl(fd, PB2_INSERT_PRIO, &prio);
+        printf("[Proc %d] Inserted: %d, Return: %d, Errno: %d\n", getpid(), i, ret, errno);
+    }
+
+    struct pb2_timed_insert req = {100, 1, 500};
+    ret = ioctl(fd, PB2_INSERT_TIMED, &req);
+    printf("[Proc %d] Timed insert on full queue, Return: %d, Errno: %d\n", getpid(), ret, errno);
+
+    wait(NULL);
+    close(fd);
+    return 0;
+}
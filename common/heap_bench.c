@@ -0,0 +1,160 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+// User-space microbenchmark of the heap core in pq_heap.h, the code both kernel
+// modules run under their locks. Reports ns per operation for inserts, extract-min,
+// extract-max and a steady mixed workload, across queue sizes and priority
+// distributions, so the data structure can be measured without loading a module.
+//
+// Usage: ./heap_bench [max_size]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pq_heap.h"
+
+#define MIN_SIZE (1 << 10)
+#define MAX_SIZE (1 << 20)
+#define MIXED_OPS (1 << 21)  // operations of the mixed workload, whatever the size
+#define RUNS 3               // the best of these is reported
+
+enum dist {
+    DIST_UNIFORM,     // priorities spread over 1 .. 2^30, few ties
+    DIST_NARROW,      // priorities 1 .. 16, mostly ties broken by insert time
+    DIST_ASCENDING,   // every insert is the new maximum
+    DIST_DESCENDING,  // every insert is the new minimum, the worst case of an insert
+    NR_DISTS
+};
+
+static const char *dist_names[NR_DISTS] = {"uniform", "narrow", "ascending", "descending"};
+
+struct queue {
+    struct element *heap;
+    int size;
+    int timer;
+};
+
+static unsigned int seed = 1;
+static volatile long sink;  // keeps the extracted values alive
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int next_rand() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void fill_priorities(int *prios, int n, enum dist dist) {
+    for (int i = 0; i < n; i++) {
+        if (dist == DIST_UNIFORM) {
+            prios[i] = 1 + next_rand() % (1 << 30);
+        } else if (dist == DIST_NARROW) {
+            prios[i] = 1 + next_rand() % 16;
+        } else if (dist == DIST_ASCENDING) {
+            prios[i] = 1 + i;
+        } else {
+            prios[i] = n - i;
+        }
+    }
+}
+
+static void insert(struct queue *q, int val, int priority) {
+    struct element elem = {val, priority, q->timer++, -1};
+    minmax_push(q->heap, q->size, NULL, &elem);
+    q->size++;
+}
+
+static int extract(struct queue *q, int largest) {
+    int i = largest ? minmax_max_index(q->heap, q->size) : 0;
+    int val = q->heap[i].val;
+    minmax_remove(q->heap, q->size, NULL, i);
+    q->size--;
+    return val;
+}
+
+static void load(struct queue *q, int *prios, int n) {
+    q->size = 0;
+    q->timer = 0;
+    for (int i = 0; i < n; i++) {
+        insert(q, i, prios[i]);
+    }
+}
+
+// ns per operation of op on a queue of n elements, the best of RUNS runs
+static double measure(const char *op, struct queue *q, int *prios, int n) {
+    double best = 0;
+    long sum = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        double start, elapsed;
+        long ops = n;
+
+        if (strcmp(op, "insert") == 0) {
+            start = now();
+            load(q, prios, n);
+            elapsed = now() - start;
+        } else if (strcmp(op, "mixed") == 0) {
+            // Hold the size at n while alternating inserts and extract-mins
+            load(q, prios, n);
+            ops = MIXED_OPS;
+            start = now();
+            for (long i = 0; i < ops / 2; i++) {
+                insert(q, i, prios[i % n]);
+                sum += extract(q, 0);
+            }
+            elapsed = now() - start;
+        } else {
+            int largest = strcmp(op, "extract_max") == 0;
+            load(q, prios, n);
+            start = now();
+            while (q->size > 0) {
+                sum += extract(q, largest);
+            }
+            elapsed = now() - start;
+        }
+        if (run == 0 || elapsed / ops < best) {
+            best = elapsed / ops;
+        }
+    }
+    sink += sum;
+    return best * 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *ops[] = {"insert", "extract_min", "extract_max", "mixed"};
+    int max_size = argc > 1 ? atoi(argv[1]) : MAX_SIZE;
+    struct queue q;
+    int *prios;
+
+    if (max_size < MIN_SIZE) {
+        max_size = MIN_SIZE;
+    }
+    q.heap = malloc((size_t)max_size * sizeof(struct element));
+    prios = malloc((size_t)max_size * sizeof(int));
+    if (q.heap == NULL || prios == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("dist,size,op,ns_per_op\n");
+    for (int dist = 0; dist < NR_DISTS; dist++) {
+        for (int n = MIN_SIZE; n <= max_size; n *= 8) {
+            fill_priorities(prios, n, dist);
+            for (int i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+                printf("%s,%d,%s,%.1f\n", dist_names[dist], n, ops[i], measure(ops[i], &q, prios, n));
+                fflush(stdout);
+            }
+        }
+    }
+    free(prios);
+    free(q.heap);
+    return 0;
+}
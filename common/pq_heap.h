@@ -0,0 +1,221 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+
+// Min-max heap of struct element, shared by the two kernel modules and the user-space
+// benchmark next to this file. It orders elements in an array owned by the caller and
+// gives the capacity limits and the array sizes to grow or shrink to, allocation and
+// locking stay with the caller.
+//
+// Nodes on even levels (the root is level 0) are smaller than all their descendants
+// and nodes on odd levels are larger than all their descendants. The minimum is
+// therefore at the root and the maximum is one of its two children, which makes both
+// extractions O(log n).
+//
+// handles may be NULL. Otherwise every element with a handle >= 0 has its new index
+// written to handles[handle].pos whenever it moves.
+
+#ifndef PQ_HEAP_H
+#define PQ_HEAP_H
+
+#ifdef __KERNEL__
+#include <linux/limits.h>
+#include <linux/log2.h>
+#include <linux/types.h>
+#else
+#include <limits.h>
+#include <stdint.h>
+typedef uint32_t u32;
+static inline int ilog2(unsigned int n) {
+    return 31 - __builtin_clz(n);
+}
+#endif
+
+struct element {
+    int val;
+    int priority;
+    int insert_time;
+    int handle;  // index in the handles array, or -1 for an element inserted without one
+};
+
+// Where the element of a handle is, heap indices are updated whenever an element moves
+struct pq_handle {
+    int pos;  // index in the heap, or -2 - the next free handle while unused
+    u32 gen;  // bumped on every release, so stale handles are rejected
+};
+
+// Comparison first based on priority and then on insert time
+static inline int compare(const struct element *a, const struct element *b) {
+    if (a->priority < b->priority) {
+        return 1;
+    } else if (a->priority > b->priority) {
+        return 0;
+    } else {
+        return a->insert_time < b->insert_time;
+    }
+}
+
+// Level parity of index i, 1 for min levels and 0 for max levels
+static inline int minmax_is_min_level(int i) {
+    return (ilog2(i + 1) & 1) == 0;
+}
+
+// Ordering used on a level: compare() on min levels, its reverse on max levels
+static inline int minmax_precedes(const struct element *heap, int i, int j, int min_level) {
+    return min_level ? compare(&heap[i], &heap[j]) : compare(&heap[j], &heap[i]);
+}
+
+// Record the new index of the element at i in its handle
+static inline void minmax_track(const struct element *heap, struct pq_handle *handles, int i) {
+    if (handles != NULL && heap[i].handle >= 0) {
+        handles[heap[i].handle].pos = i;
+    }
+}
+
+static inline void minmax_swap(struct element *heap, struct pq_handle *handles, int i, int j) {
+    struct element temp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = temp;
+    minmax_track(heap, handles, i);
+    minmax_track(heap, handles, j);
+}
+
+// Move element i up through its grandparents, which all lie on the same kind of level
+static inline void minmax_shift_up_level(struct element *heap, struct pq_handle *handles, int i, int min_level) {
+    int grandparent;
+    while (i > 2) {
+        grandparent = ((i - 1) / 2 - 1) / 2;
+        if (!minmax_precedes(heap, i, grandparent, min_level)) {
+            break;
+        }
+        minmax_swap(heap, handles, i, grandparent);
+        i = grandparent;
+    }
+}
+
+static inline void minmax_shift_up(struct element *heap, struct pq_handle *handles, int i) {
+    int parent, min_level;
+    if (i == 0) {
+        return;
+    }
+    parent = (i - 1) / 2;
+    min_level = minmax_is_min_level(i);
+    // If i is out of order with its parent it belongs on the parent's kind of level
+    if (minmax_precedes(heap, parent, i, min_level)) {
+        minmax_swap(heap, handles, i, parent);
+        minmax_shift_up_level(heap, handles, parent, !min_level);
+    } else {
+        minmax_shift_up_level(heap, handles, i, min_level);
+    }
+}
+
+static inline void minmax_shift_down(struct element *heap, int size, struct pq_handle *handles, int i) {
+    int child, last, best, j, min_level;
+    min_level = minmax_is_min_level(i);
+    while (2 * i + 1 < size) {
+        // Pick the smallest (largest on a max level) among the children and grandchildren
+        child = 2 * i + 1;
+        best = child;
+        if (child + 1 < size && minmax_precedes(heap, child + 1, best, min_level)) {
+            best = child + 1;
+        }
+        last = 4 * i + 6 < size - 1 ? 4 * i + 6 : size - 1;
+        for (j = 4 * i + 3; j <= last; j++) {
+            if (minmax_precedes(heap, j, best, min_level)) {
+                best = j;
+            }
+        }
+        if (!minmax_precedes(heap, best, i, min_level)) {
+            break;
+        }
+        minmax_swap(heap, handles, i, best);
+        if (best <= child + 1) {
+            break;
+        }
+        // best is a grandchild, the element moved there may now be out of order with its parent
+        if (minmax_precedes(heap, (best - 1) / 2, best, min_level)) {
+            minmax_swap(heap, handles, best, (best - 1) / 2);
+        }
+        i = best;
+    }
+}
+
+// Restore the heap order after the element at index i changed. It can only be out of
+// order with its ancestors or with its descendants: minmax_shift_up() handles the first
+// case and leaves an element at i that may still belong further down.
+static inline void minmax_restore(struct element *heap, int size, struct pq_handle *handles, int i) {
+    minmax_shift_up(heap, handles, i);
+    minmax_shift_down(heap, size, handles, i);
+}
+
+// Add elem to a heap of size elements with room for one more, the caller then counts it
+static inline void minmax_push(struct element *heap, int size, struct pq_handle *handles, const struct element *elem) {
+    heap[size] = *elem;
+    minmax_track(heap, handles, size);
+    minmax_shift_up(heap, handles, size);
+}
+
+// Remove the element at index i of a heap of size elements by moving the last element
+// into its place, the caller then counts one element less
+static inline void minmax_remove(struct element *heap, int size, struct pq_handle *handles, int i) {
+    if (i < size - 1) {
+        heap[i] = heap[size - 1];
+        minmax_track(heap, handles, i);
+        minmax_restore(heap, size - 1, handles, i);
+    }
+}
+
+// Index of the maximum element of a non-empty heap: the root itself or the larger of its two children
+static inline int minmax_max_index(const struct element *heap, int size) {
+    if (size <= 2) {
+        return size - 1;
+    }
+    return compare(&heap[1], &heap[2]) ? 2 : 1;
+}
+
+// Floyd's bottom-up construction: shift down every inner node, last first. Most nodes
+// are near the bottom and move little, so this is O(n) instead of O(n log n).
+static inline void minmax_heapify(struct element *heap, int size, struct pq_handle *handles) {
+    int i;
+    for (i = size / 2 - 1; i >= 0; i--) {
+        minmax_shift_down(heap, size, handles, i);
+    }
+}
+
+// Capacity limits and heap array sizes
+
+#define PQ_UNBOUNDED (-1)  // capacity of a queue limited only by PQ_MAX_CAPACITY
+#define PQ_MAX_CAPACITY ((int)(INT_MAX / sizeof(struct element)))  // keeps the heap array below INT_MAX bytes, the most kvmalloc() accepts
+#define PQ_MIN_ALLOC 16    // smallest heap array, a queue never shrinks below it
+
+// Whether a queue may be given this capacity: 1 to PQ_MAX_CAPACITY, or PQ_UNBOUNDED
+static inline int pq_valid_capacity(int capacity) {
+    return capacity == PQ_UNBOUNDED || (capacity >= 1 && capacity <= PQ_MAX_CAPACITY);
+}
+
+// Maximum number of elements of a queue with this capacity
+static inline int pq_capacity_limit(int capacity) {
+    return capacity == PQ_UNBOUNDED ? PQ_MAX_CAPACITY : capacity;
+}
+
+// Elements the heap array should hold for n elements when it holds alloc, doubling so that
+// a run of inserts costs O(1) amortized, but no more than limit
+static inline int pq_grow_alloc(int alloc, int n, int limit) {
+    alloc = alloc > PQ_MIN_ALLOC ? alloc : PQ_MIN_ALLOC;
+    while (alloc < n) {
+        alloc *= 2;
+    }
+    return alloc < limit ? alloc : limit;
+}
+
+// Elements the heap array should hold once the queue has drained to size elements: half
+// of alloc when only a quarter of it is used, alloc otherwise
+static inline int pq_shrink_alloc(int alloc, int size) {
+    if (alloc > PQ_MIN_ALLOC && size <= alloc / 4) {
+        return alloc / 2 > PQ_MIN_ALLOC ? alloc / 2 : PQ_MIN_ALLOC;
+    }
+    return alloc;
+}
+
+#endif
@@ -0,0 +1,412 @@
+/*
+    Ashutosh Kumar Singh - 19CS30008
+    Vanshita Garg - 19CS10064
+*/
+// Throughput and latency benchmark of the proc files of both modules. For 1, 2, 4 ... N
+// workers, each pinned to a CPU, every worker opens the proc file and runs a random mix
+// of operations for a fixed time. Each operation is timed and one CSV row per command
+// reports its throughput and latency percentiles.
+//
+// Usage: ./proc_bench [options]
+//   -f a2|partb    proc file to drive: /proc/cs60038_a2_grp3 (default) or /proc/partb_1_3
+//   -w N           largest number of workers (default: online CPUs)
+//   -T             workers are threads of one process instead of processes
+//   -d SECONDS     duration of each run (default 2)
+//   -s CAPACITY    queue capacity (default 1024), queues start half full
+//   -r RANGE       priorities are uniform in 1 .. RANGE (default 1000)
+//   -m MIX         op weights, e.g. insert=50,get_min=40,get_max=10 (default insert=50,get_min=50)
+//   -b BATCH       pairs per batch op (default 16)
+//   -q NAME        a2 only: all workers attach to one named queue instead of private queues
+//   -R             a2 only: the named queue is relaxed
+//   -C             a2 only: workers set PB2_MODE_COMBINE, mode is then reported with -combine
+//
+// Commands: insert (PB2_INSERT_INT + PB2_INSERT_PRIO, or an 8-byte record write on
+// partb), get_min (PB2_GET_MIN, or a 4-byte read on partb), get_max and batch
+// (PB2_INSERT_BATCH). partb reads expect the module's read_records parameter to be off.
+// An op rejected on a full or empty queue counts as failed and is
+// not in the percentiles.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+
+#define PB2_SET_CAPACITY _IOW(0x10, 0x31, int32_t *)
+#define PB2_INSERT_INT _IOW(0x10, 0x32, int32_t *)
+#define PB2_INSERT_PRIO _IOW(0x10, 0x33, int32_t *)
+#define PB2_GET_MIN _IOR(0x10, 0x35, int32_t *)
+#define PB2_GET_MAX _IOR(0x10, 0x36, int32_t *)
+#define PB2_INSERT_BATCH _IOWR(0x10, 0x37, struct pb2_batch *)
+#define PB2_SET_MODE _IOW(0x10, 0x3d, int32_t *)
+#define PB2_ATTACH _IOW(0x10, 0x3f, struct pb2_attach *)
+
+#define PB2_MODE_COMBINE 0x4
+
+#define PB2_ATTACH_CREATE 0x1
+#define PB2_ATTACH_RELAXED 0x4
+#define PB2_NAME_LEN 32
+
+#define MAX_BATCH 1024
+#define SUB_BITS 5                 // latency buckets per power of two are 2^SUB_BITS, about 3% wide
+#define SUB (1 << SUB_BITS)
+#define NR_BUCKETS (60 * SUB)      // enough for any 64-bit ns value
+
+enum cmd { CMD_INSERT, CMD_GET_MIN, CMD_GET_MAX, CMD_BATCH, NR_CMDS };
+
+static const char *cmd_names[NR_CMDS] = {"insert", "get_min", "get_max", "batch"};
+
+struct pb2_pair {
+    int32_t val;
+    int32_t priority;
+};
+
+struct pb2_batch {
+    struct pb2_pair *pairs;
+    int32_t count;
+    int32_t accepted;
+};
+
+struct pb2_attach {
+    char name[PB2_NAME_LEN];
+    int32_t capacity;
+    int32_t flags;
+};
+
+// Results of one worker, in shared memory so that forked workers can report them
+struct result {
+    long ops[NR_CMDS];     // successful ops
+    long failed[NR_CMDS];  // rejected on a full or empty queue
+    long errors;           // any other failure, the worker stops at the first one
+    long hist[NR_CMDS][NR_BUCKETS];
+};
+
+static struct {
+    int partb;
+    int threads;
+    int max_workers;
+    double seconds;
+    int capacity;
+    int range;
+    int weights[NR_CMDS];
+    int batch;
+    const char *name;
+    int relaxed;
+    int combine;
+} opt = {0, 0, 0, 2.0, 1024, 1000, {50, 50, 0, 0}, 16, NULL, 0, 0};
+
+struct worker {
+    int id;
+    int nr_workers;
+    double start;  // CLOCK_MONOTONIC time at which all workers begin
+    struct result *res;
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Log-linear bucket of a latency: exact below SUB ns, then SUB buckets per power of two
+static int bucket_of(uint64_t ns) {
+    int shift;
+    if (ns < SUB) {
+        return ns;
+    }
+    shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+    return (shift + 1) * SUB + (int)((ns >> shift) - SUB);
+}
+
+// Smallest latency that falls into bucket b
+static uint64_t bucket_value(int b) {
+    if (b < SUB) {
+        return b;
+    }
+    return (uint64_t)(SUB + b % SUB) << (b / SUB - 1);
+}
+
+static uint64_t percentile(long *hist, long total, double p) {
+    long rank = (long)(p * total), seen = 0;
+    if (total == 0) {
+        return 0;
+    }
+    for (int b = 0; b < NR_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) {
+            return bucket_value(b);
+        }
+    }
+    return bucket_value(NR_BUCKETS - 1);
+}
+
+static void pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+// Open the proc file and set up a queue, returns the fd or -1
+static int open_queue() {
+    int fd = open(opt.partb ? "/proc/partb_1_3" : "/proc/cs60038_a2_grp3", O_RDWR);
+    int ret;
+
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    if (opt.combine) {
+        int mode = PB2_MODE_COMBINE;
+        if (ioctl(fd, PB2_SET_MODE, &mode) < 0) {
+            perror("set mode");
+            close(fd);
+            return -1;
+        }
+    }
+    if (opt.partb) {
+        ret = write(fd, &opt.capacity, sizeof(int)) == sizeof(int) ? 0 : -1;
+    } else if (opt.name != NULL) {
+        struct pb2_attach req = {"", opt.capacity, PB2_ATTACH_CREATE | (opt.relaxed ? PB2_ATTACH_RELAXED : 0)};
+        strncpy(req.name, opt.name, PB2_NAME_LEN - 1);
+        ret = ioctl(fd, PB2_ATTACH, &req);
+    } else {
+        ret = ioctl(fd, PB2_SET_CAPACITY, &opt.capacity);
+    }
+    if (ret < 0) {
+        perror("queue setup");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Run one command, returns 0, or -1 with errno set
+static int run_cmd(int fd, int cmd, unsigned *seed, struct pb2_pair *pairs) {
+    int val = rand_r(seed), prio = 1 + rand_r(seed) % opt.range, out;
+
+    if (cmd == CMD_INSERT) {
+        if (opt.partb) {
+            int record[2] = {val, prio};
+            return write(fd, record, sizeof(record)) == sizeof(record) ? 0 : -1;
+        }
+        if (ioctl(fd, PB2_INSERT_INT, &val) < 0) {
+            return -1;
+        }
+        return ioctl(fd, PB2_INSERT_PRIO, &prio);
+    } else if (cmd == CMD_GET_MIN) {
+        if (opt.partb) {
+            return read(fd, &out, sizeof(int)) == sizeof(int) ? 0 : -1;
+        }
+        return ioctl(fd, PB2_GET_MIN, &out);
+    } else if (cmd == CMD_GET_MAX) {
+        return ioctl(fd, PB2_GET_MAX, &out);
+    }
+    struct pb2_batch batch = {pairs, opt.batch, 0};
+    for (int i = 0; i < opt.batch; i++) {
+        pairs[i].val = rand_r(seed);
+        pairs[i].priority = 1 + rand_r(seed) % opt.range;
+    }
+    return ioctl(fd, PB2_INSERT_BATCH, &batch);
+}
+
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    struct result *res = w->res;
+    struct pb2_pair pairs[MAX_BATCH];
+    unsigned seed = 1 + w->id;
+    int total_weight = 0, fd, cmd, pick;
+    uint64_t start, end, deadline;
+
+    pin(w->id);
+    fd = open_queue();
+    if (fd < 0) {
+        res->errors++;
+        return NULL;
+    }
+    // Fill the queue halfway, shared by all workers for a named queue
+    int prefill = opt.capacity / 2 / (opt.name != NULL ? w->nr_workers : 1);
+    for (int i = 0; i < prefill; i++) {
+        run_cmd(fd, CMD_INSERT, &seed, pairs);
+    }
+    for (cmd = 0; cmd < NR_CMDS; cmd++) {
+        total_weight += opt.weights[cmd];
+    }
+
+    while (now() < w->start) {
+        usleep(1000);
+    }
+    deadline = now_ns() + (uint64_t)(opt.seconds * 1e9);
+    do {
+        pick = rand_r(&seed) % total_weight;
+        for (cmd = 0; pick >= opt.weights[cmd]; cmd++) {
+            pick -= opt.weights[cmd];
+        }
+        start = now_ns();
+        if (run_cmd(fd, cmd, &seed, pairs) == 0) {
+            end = now_ns();
+            res->ops[cmd]++;
+            res->hist[cmd][bucket_of(end - start)]++;
+        } else if (errno == EACCES || errno == EAGAIN) {
+            end = now_ns();
+            res->failed[cmd]++;
+        } else {
+            perror(cmd_names[cmd]);
+            res->errors++;
+            break;
+        }
+    } while (end < deadline);
+    close(fd);
+    return NULL;
+}
+
+// Run nr workers at once and print a row per command they used
+static int run(int nr) {
+    struct result *res = mmap(NULL, nr * sizeof(struct result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    struct worker *workers = calloc(nr, sizeof(struct worker));
+    pthread_t *tids = calloc(nr, sizeof(pthread_t));
+    double start = now() + 0.2 + 0.01 * nr;  // time for every worker to set up its queue
+    long errors = 0;
+
+    if (res == MAP_FAILED || workers == NULL || tids == NULL) {
+        perror("alloc");
+        return -1;
+    }
+    for (int i = 0; i < nr; i++) {
+        workers[i] = (struct worker){i, nr, start, &res[i]};
+        if (opt.threads) {
+            pthread_create(&tids[i], NULL, run_worker, &workers[i]);
+        } else if (fork() == 0) {
+            run_worker(&workers[i]);
+            exit(0);
+        }
+    }
+    for (int i = 0; i < nr; i++) {
+        if (opt.threads) {
+            pthread_join(tids[i], NULL);
+        } else {
+            wait(NULL);
+        }
+    }
+
+    // Merge the workers into res[0]
+    for (int i = 0; i < nr; i++) {
+        errors += res[i].errors;
+        for (int c = 0; i > 0 && c < NR_CMDS; c++) {
+            res[0].ops[c] += res[i].ops[c];
+            res[0].failed[c] += res[i].failed[c];
+            for (int b = 0; b < NR_BUCKETS; b++) {
+                res[0].hist[c][b] += res[i].hist[c][b];
+            }
+        }
+    }
+    for (int c = 0; errors == 0 && c < NR_CMDS; c++) {
+        long ops = res[0].ops[c];
+        if (opt.weights[c] == 0) {
+            continue;
+        }
+        printf("%s,%s%s,%d,%s,%ld,%ld,%.0f,%llu,%llu,%llu\n", opt.partb ? "partb" : "a2", opt.threads ? "threads" : "procs",
+               opt.combine ? "-combine" : "", nr, cmd_names[c], ops, res[0].failed[c], ops / opt.seconds,
+               (unsigned long long)percentile(res[0].hist[c], ops, 0.5),
+               (unsigned long long)percentile(res[0].hist[c], ops, 0.99),
+               (unsigned long long)percentile(res[0].hist[c], ops, 0.999));
+    }
+    fflush(stdout);
+    munmap(res, nr * sizeof(struct result));
+    free(workers);
+    free(tids);
+    return errors > 0 ? -1 : 0;
+}
+
+static int parse_mix(char *mix) {
+    char *tok, *eq;
+    memset(opt.weights, 0, sizeof(opt.weights));
+    for (tok = strtok(mix, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        int c;
+        eq = strchr(tok, '=');
+        if (eq == NULL) {
+            return -1;
+        }
+        *eq = '\0';
+        for (c = 0; c < NR_CMDS && strcmp(tok, cmd_names[c]) != 0; c++) {
+        }
+        if (c == NR_CMDS) {
+            return -1;
+        }
+        opt.weights[c] = atoi(eq + 1);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int c, total = 0;
+
+    opt.max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((c = getopt(argc, argv, "f:w:Td:s:r:m:b:q:RC")) != -1) {
+        if (c == 'f') {
+            opt.partb = strcmp(optarg, "partb") == 0;
+        } else if (c == 'w') {
+            opt.max_workers = atoi(optarg);
+        } else if (c == 'T') {
+            opt.threads = 1;
+        } else if (c == 'd') {
+            opt.seconds = atof(optarg);
+        } else if (c == 's') {
+            opt.capacity = atoi(optarg);
+        } else if (c == 'r') {
+            opt.range = atoi(optarg);
+        } else if (c == 'm') {
+            if (parse_mix(optarg) < 0) {
+                fprintf(stderr, "Invalid mix %s\n", optarg);
+                return 1;
+            }
+        } else if (c == 'b') {
+            opt.batch = atoi(optarg);
+        } else if (c == 'q') {
+            opt.name = optarg;
+        } else if (c == 'R') {
+            opt.relaxed = 1;
+        } else if (c == 'C') {
+            opt.combine = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-f a2|partb] [-w workers] [-T] [-d seconds] [-s capacity] [-r range] [-m mix] [-b batch] [-q name] [-R] [-C]\n", argv[0]);
+            return 1;
+        }
+    }
+    for (c = 0; c < NR_CMDS; c++) {
+        total += opt.weights[c];
+    }
+    if (total <= 0 || opt.max_workers < 1 || opt.seconds <= 0 || opt.capacity < 2 || opt.range < 1 ||
+        opt.batch < 1 || opt.batch > MAX_BATCH) {
+        fprintf(stderr, "Invalid options\n");
+        return 1;
+    }
+    if (opt.partb && (opt.weights[CMD_GET_MAX] > 0 || opt.weights[CMD_BATCH] > 0 || opt.name != NULL || opt.combine)) {
+        fprintf(stderr, "partb only supports insert and get_min on private queues, without -C\n");
+        return 1;
+    }
+
+    printf("target,mode,workers,cmd,ops,failed,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    fflush(stdout);  // not to be repeated by the exit() of forked workers
+    // 1, 2, 4 ... workers, ending with max_workers itself
+    for (int nr = 1; nr <= opt.max_workers; nr = nr < opt.max_workers && nr * 2 > opt.max_workers ? opt.max_workers : nr * 2) {
+        if (run(nr) < 0) {
+            return 1;
+        }
+    }
+    return 0;
+}